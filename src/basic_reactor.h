@@ -0,0 +1,342 @@
+/**
+ *  Reactor with the demultiplexer and the event handler type chosen at
+ *  compile time. Reactor goes through the virtual ReactorImpl bridge and
+ *  the virtual EventHandler::handle_event() for every event; here both are
+ *  template parameters, so the dispatch loop calls the handler directly
+ *  and the compiler can inline it.
+ *
+ *  Handlers are of any type with
+ *    void handle_event(Socket handle, EventType et);
+ *    Socket get_handle() const;
+ *  and carry their own context. FunctionHandler wraps a callable, e.g. a
+ *  lambda capturing what it needs. Using EventHandler itself as the handler
+ *  type gives back dynamic dispatch, without the ReactorImpl bridge.
+ */
+#ifndef BASIC_REACTOR_H_
+#define BASIC_REACTOR_H_
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined (HAS_EPOLL)
+#include <sys/epoll.h>
+#endif // HAS_EPOLL
+
+#include "common.h"
+#include "timer.h"
+
+/**
+ * @class FunctionHandler
+ *
+ * @brief Handler calling @a F with (Socket, EventType).
+ */
+template <class F>
+class FunctionHandler {
+public:
+  FunctionHandler(Socket handle, F func) : handle_(handle), func_(func) {
+  }
+
+  void handle_event(Socket handle, EventType et) {
+    func_(handle, et);
+  }
+
+  Socket get_handle() const {
+    return handle_;
+  }
+
+private:
+  Socket handle_;
+  F func_;
+};
+
+template <class F>
+FunctionHandler<F> make_handler(Socket handle, F func) {
+  return FunctionHandler<F>(handle, func);
+}
+
+/**
+ * @brief Events of a handle are reported by one handle_event() call with
+ * all of READ_EVENT, WRITE_EVENT and CLOSE_EVENT which apply. CLOSE_EVENT
+ * comes alone when there is nothing left to read.
+ */
+inline EventType poll_to_events(unsigned int revents, unsigned int in, unsigned int out,
+                                unsigned int hangup) {
+  EventType et = 0;
+  if (revents & in)
+    et |= READ_EVENT;
+  if (revents & out)
+    et |= WRITE_EVENT;
+  if ((revents & hangup) && !(revents & in))
+    et |= CLOSE_EVENT;
+  return et;
+}
+
+#if defined (HAS_EPOLL)
+/**
+ * @class EpollBackend
+ *
+ * @brief Level-triggered epoll for BasicReactor. The handler is stored in
+ * epoll_event.data, so dispatching needs no table lookup. Removing a
+ * handler while dispatching clears its events left in the current batch.
+ */
+template <class Handler>
+class EpollBackend {
+public:
+  EpollBackend(const ReactorConfig& config) : events_(config.max_events) {
+    epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd_ < 0) {
+      perror("epoll_create");
+      exit(EXIT_FAILURE);
+    }
+    next_ = count_ = 0;
+  }
+
+  ~EpollBackend() {
+    close(epollfd_);
+  }
+
+  bool add(Handler* eh, EventType et) {
+    return control(EPOLL_CTL_ADD, eh, et);
+  }
+
+  bool modify(Handler* eh, EventType et) {
+    return control(EPOLL_CTL_MOD, eh, et);
+  }
+
+  void remove(Handler* eh) {
+    struct epoll_event event = epoll_event();
+    epoll_ctl(epollfd_, EPOLL_CTL_DEL, eh->get_handle(), &event);
+    for (int i = next_; i < count_; i++) {
+      if (events_[i].data.ptr == eh)
+        events_[i].data.ptr = nullptr;
+    }
+  }
+
+  /**
+   * @brief Wait up to @a timeout_ms (-1 for ever), then call @a dispatch
+   * with (Handler*, Socket, EventType) for every ready handle.
+   */
+  template <class Dispatch>
+  int wait(int timeout_ms, Dispatch& dispatch) {
+    count_ = epoll_wait(epollfd_, &events_[0], events_.size(), timeout_ms);
+    if (count_ < 0) {
+      perror("epoll_wait");
+      count_ = 0;
+      return -1;
+    }
+
+    for (next_ = 0; next_ < count_; ) {
+      struct epoll_event& event = events_[next_++];
+      Handler* eh = (Handler*) event.data.ptr;
+      if (eh == nullptr)
+        continue;
+      dispatch(eh, eh->get_handle(),
+               poll_to_events(event.events, EPOLLIN, EPOLLOUT, EPOLLHUP | EPOLLERR));
+    }
+    int n = count_;
+    next_ = count_ = 0;
+    return n;
+  }
+
+private:
+  bool control(int op, Handler* eh, EventType et) {
+    struct epoll_event event;
+    event.data.ptr = eh;
+    event.events = 0;
+    if ((et & READ_EVENT) == READ_EVENT)
+      event.events |= EPOLLIN;
+    if ((et & WRITE_EVENT) == WRITE_EVENT)
+      event.events |= EPOLLOUT;
+    if (epoll_ctl(epollfd_, op, eh->get_handle(), &event) < 0) {
+      perror("epoll_ctl");
+      return false;
+    }
+    return true;
+  }
+
+private:
+  int epollfd_;
+  std::vector<struct epoll_event> events_;
+  int next_;   // Next event of the batch being dispatched
+  int count_;
+};
+#endif // HAS_EPOLL
+
+/**
+ * @class PollBackend
+ *
+ * @brief poll() for BasicReactor, with a dense pollfd array next to the
+ * array of handlers. Removal moves the last entry into the freed place.
+ */
+template <class Handler>
+class PollBackend {
+public:
+  PollBackend(const ReactorConfig& config) {
+  }
+
+  bool add(Handler* eh, EventType et) {
+    struct pollfd entry;
+    entry.fd = eh->get_handle();
+    entry.events = to_poll(et);
+    entry.revents = 0;
+    fds_.push_back(entry);
+    handlers_.push_back(eh);
+    return true;
+  }
+
+  bool modify(Handler* eh, EventType et) {
+    size_t i = find(eh);
+    if (i == fds_.size())
+      return false;
+    fds_[i].events = to_poll(et);
+    return true;
+  }
+
+  void remove(Handler* eh) {
+    size_t i = find(eh);
+    if (i == fds_.size())
+      return;
+    fds_[i] = fds_.back();
+    handlers_[i] = handlers_.back();
+    fds_.pop_back();
+    handlers_.pop_back();
+  }
+
+  template <class Dispatch>
+  int wait(int timeout_ms, Dispatch& dispatch) {
+    int nready = poll(fds_.empty() ? nullptr : &fds_[0], fds_.size(), timeout_ms);
+    if (nready < 0) {
+      perror("poll");
+      return -1;
+    }
+
+    int n = nready;
+    for (size_t i = 0; nready > 0 && i < fds_.size(); ) {
+      short revents = fds_[i].revents;
+      Socket fd = fds_[i].fd;
+      if (revents == 0) {
+        i++;
+        continue;
+      }
+      fds_[i].revents = 0;
+      nready--;
+      dispatch(handlers_[i], fd,
+               poll_to_events(revents, POLLIN, POLLOUT, POLLHUP | POLLERR));
+      // A handler removing itself moves another entry into its place
+      if (i < fds_.size() && fds_[i].fd == fd)
+        i++;
+    }
+    return n;
+  }
+
+private:
+  static short to_poll(EventType et) {
+    short events = 0;
+    if ((et & READ_EVENT) == READ_EVENT)
+      events |= POLLIN;
+    if ((et & WRITE_EVENT) == WRITE_EVENT)
+      events |= POLLOUT;
+    return events;
+  }
+
+  size_t find(Handler* eh) const {
+    size_t i = 0;
+    while (i < handlers_.size() && handlers_[i] != eh) {
+      i++;
+    }
+    return i;
+  }
+
+private:
+  std::vector<struct pollfd> fds_;
+  std::vector<Handler*> handlers_;
+};
+
+/**
+ * @class BasicReactor
+ *
+ * @brief Demultiplex with Backend<Handler> and dispatch to Handler without
+ * virtual calls, e.g. BasicReactor<EpollBackend, SipConnection>. Timers
+ * work as with Reactor. Not thread-safe, one per thread.
+ */
+template <template <class> class Backend, class Handler>
+class BasicReactor {
+public:
+  BasicReactor(const ReactorConfig& config=ReactorConfig())
+    : backend_(config), timers_(monotonic_ms()) {
+    now_ = monotonic_ms();
+  }
+
+  bool register_handler(Handler* eh, EventType et) {
+    return backend_.add(eh, et);
+  }
+
+  bool modify_handler(Handler* eh, EventType et) {
+    return backend_.modify(eh, et);
+  }
+
+  /**
+   * @brief Safe from a handler, also for itself.
+   */
+  void remove_handler(Handler* eh) {
+    backend_.remove(eh);
+  }
+
+  /**
+   * @brief Wait no longer than @a timeout nor than the earliest timer,
+   * dispatch the events, then fire the due timers.
+   */
+  void handle_events(TimeValue* timeout=nullptr) {
+    int wait = (timeout == nullptr) ? -1 : timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+    unsigned long long next = timers_.next_expiry();
+    if (next != ~0ULL) {
+      unsigned long long delay = (next > now_) ? next - now_ : 0;
+      if (wait < 0 || delay < (unsigned long long) wait)
+        wait = (int) delay;
+    }
+
+    Dispatch dispatch;
+    backend_.wait(wait, dispatch);
+    now_ = monotonic_ms();
+
+    if (timers_.size() != 0)
+      timers_.expire(now_);
+  }
+
+  /**
+   * @brief Call @a cb with @a arg from handle_events() after @a delay_ms.
+   */
+  TimerId schedule_timer(unsigned int delay_ms, TimerCallback cb, void* arg) {
+    if (cb == nullptr)
+      return 0;
+    return timers_.schedule(now_ + delay_ms, cb, arg);
+  }
+
+  bool cancel_timer(TimerId id) {
+    return timers_.cancel(id);
+  }
+
+  /**
+   * @brief CLOCK_MONOTONIC time in milliseconds of the last wakeup.
+   */
+  unsigned long long now() const {
+    return now_;
+  }
+
+private:
+  struct Dispatch {
+    void operator()(Handler* eh, Socket handle, EventType et) {
+      eh->handle_event(handle, et);
+    }
+  };
+
+private:
+  Backend<Handler> backend_;
+  TimingWheel timers_;
+  unsigned long long now_;
+};
+
+#endif // BASIC_REACTOR_H_
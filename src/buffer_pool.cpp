@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+
+BufferPool::BufferPool(bool huge_pages) {
+  huge_pages_ = huge_pages;
+  in_use_ = 0;
+}
+
+BufferPool::~BufferPool() {
+  for (size_t i = 0; i < chunks_.size(); i++) {
+    munmap(chunks_[i], RECV_BUF_CHUNK);
+  }
+}
+
+size_t BufferPool::size_of(int cls) {
+  size_t size = (size_t) RECV_BUF_MIN_SIZE << (3 * cls);
+  return (size > SIP_MSG_MAX_SIZE) ? SIP_MSG_MAX_SIZE : size;
+}
+
+int BufferPool::class_of(size_t size) {
+  for (int cls = 0; cls < (int) RECV_BUF_CLASSES; cls++) {
+    if (size <= size_of(cls))
+      return cls;
+  }
+  return -1;
+}
+
+size_t BufferPool::class_size(size_t size) {
+  int cls = class_of(size);
+  return (cls < 0) ? 0 : size_of(cls);
+}
+
+/**
+ * @brief Map a chunk and split it into buffers of class @a cls.
+ */
+bool BufferPool::grow(int cls) {
+  void* chunk = MAP_FAILED;
+#if defined (MAP_HUGETLB)
+  if (huge_pages_)
+    chunk = mmap(nullptr, RECV_BUF_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif // MAP_HUGETLB
+  if (chunk == MAP_FAILED) {
+    chunk = mmap(nullptr, RECV_BUF_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+      perror("mmap receive buffers");
+      return false;
+    }
+#if defined (MADV_HUGEPAGE)
+    // No huge page reserved, let the kernel back the chunk with
+    // transparent ones where it can
+    if (huge_pages_)
+      madvise(chunk, RECV_BUF_CHUNK, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+  }
+  chunks_.push_back((char*) chunk);
+
+  size_t size = size_of(cls);
+  // Handed out from the start of the chunk, like a stack
+  for (size_t offset = RECV_BUF_CHUNK; offset >= size; offset -= size) {
+    free_[cls].push_back((char*) chunk + offset - size);
+  }
+  return true;
+}
+
+char* BufferPool::get(size_t size) {
+  int cls = class_of(size);
+  if (cls < 0)
+    return nullptr;
+  if (free_[cls].empty() && !grow(cls))
+    return nullptr;
+
+  char* buf = free_[cls].back();
+  free_[cls].pop_back();
+  in_use_++;
+  return buf;
+}
+
+void BufferPool::put(char* buf, size_t size) {
+  if (buf == nullptr)
+    return;
+  free_[class_of(size)].push_back(buf);
+  in_use_--;
+}
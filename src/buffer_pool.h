@@ -0,0 +1,71 @@
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * @class BufferPool
+ *
+ * @brief Receive buffers shared by the connections of a Reactor, in
+ * RECV_BUF_CLASSES size classes from RECV_BUF_MIN_SIZE up to
+ * SIP_MSG_MAX_SIZE, each 8 times the previous one. Buffers are carved
+ * from chunks of RECV_BUF_CHUNK bytes mapped on demand, optionally backed
+ * by huge pages, and recycled through a free list per class. Chunks are
+ * only unmapped with the pool, which must outlive the buffers. A pool is
+ * not thread-safe, it belongs to one Reactor.
+ */
+class BufferPool {
+public:
+  /**
+   * @brief With @a huge_pages, chunks are mapped with MAP_HUGETLB, or
+   * advised to use transparent huge pages if none are reserved.
+   */
+  BufferPool(bool huge_pages=false);
+  ~BufferPool();
+
+  /**
+   * @brief Size of the smallest class holding @a size bytes, 0 if none does.
+   */
+  static size_t class_size(size_t size);
+
+  /**
+   * @brief A buffer of class_size(@a size) bytes, nullptr if @a size is
+   * above SIP_MSG_MAX_SIZE or out of memory.
+   */
+  char* get(size_t size);
+
+  /**
+   * @brief Give back a buffer of @a size bytes, as passed to get().
+   */
+  void put(char* buf, size_t size);
+
+  /**
+   * @brief Buffers handed out and not given back yet.
+   */
+  size_t in_use() const {
+    return in_use_;
+  }
+
+  /**
+   * @brief Bytes of chunks mapped so far.
+   */
+  size_t mapped() const {
+    return chunks_.size() * (size_t) RECV_BUF_CHUNK;
+  }
+
+private:
+  static size_t size_of(int cls);
+  static int class_of(size_t size);
+  bool grow(int cls);
+
+private:
+  bool huge_pages_;
+  std::vector<char*> chunks_;
+  std::vector<char*> free_[RECV_BUF_CLASSES];
+  size_t in_use_;
+};
+
+#endif // BUFFER_POOL_H_
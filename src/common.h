@@ -1,13 +1,42 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stddef.h>
 #include <sys/time.h>
+#include <netinet/in.h>
 
-const unsigned int MAXFD = 10000; //this is the number of pollfd as input to poll()
+const unsigned int HANDLE_TABLE_CHUNK = 256; //handle slots allocated at once (power of 2)
+const unsigned int MAX_EVENTS_PER_WAIT = 1024; //default number of events retrieved by one wait
 const unsigned int BACKLOG = 1000;
 const unsigned int SIP_MSG_MAX_SIZE = 64*1024; //maximum size of SIP message we accept
 const unsigned int SIP_UDP_MSG_MAX_SIZE = 3*1024; //maximum size of SIP message through UDP
 const unsigned int TEMP_MSG_SIZE = 1024;  //Length of data each time read() from kernel
+const unsigned int URING_QUEUE_DEPTH = 4096; //number of submission queue entries of io_uring
+const unsigned int URING_BUF_COUNT = 4096;   //number of kernel-provided receive buffers (power of 2)
+const unsigned int URING_BUF_SIZE = 4*1024;  //size of each provided buffer, fits a SIP UDP message
+const unsigned int UDP_RECV_BATCH = 32;      //default number of datagrams received by one recvmmsg()
+const unsigned int UDP_RECV_BATCH_MAX = 64;  //upper bound of the above
+const unsigned int UDP_SEND_BATCH = 64;      //datagrams written by one sendmmsg()
+const unsigned int UDP_SEND_QUEUE_MAX = 4096; //datagrams queued per UDP socket
+const unsigned int UDP_TALKER_SLOTS = 1024;  //peers tracked for connected sockets (power of 2)
+const unsigned int TCP_OUT_BLOCK_SIZE = 16*1024; //TCP output is queued in blocks of this size
+const unsigned int TCP_OUT_IOV = 16;         //blocks written by one sendmsg()
+const unsigned int TCP_SENDFILE_CHUNK = 256*1024; //file bytes written by one sendfile()
+const unsigned int ZEROCOPY_REAP_MS = 10;    //polling of closed sockets waiting for zero-copy completions
+const unsigned int ZEROCOPY_LINGER_MS = 10000; //TCP_USER_TIMEOUT of those sockets
+const unsigned int RELAY_PIPE_SIZE = 64*1024; //bytes buffered in the pipe of a relay direction
+const unsigned int POOL_SLAB_OBJECTS = 64;   //objects carved from one slab of an ObjectPool
+const unsigned int RECV_BUF_MIN_SIZE = 2*1024; //smallest TCP receive buffer, fits most SIP messages
+const unsigned int RECV_BUF_CLASSES = 3;     //receive buffer sizes: 2KB, 16KB, SIP_MSG_MAX_SIZE
+const unsigned int RECV_BUF_CHUNK = 2*1024*1024; //receive buffers are mapped in chunks of a huge page
+const unsigned int TASK_QUEUE_SIZE = 4096;   //tasks posted to a Reactor and not run yet (power of 2)
+const unsigned int TASK_BATCH = 256;         //posted tasks run per loop iteration
+const unsigned int WORKER_QUEUE_SIZE = 1024; //messages queued from a Reactor to a worker (power of 2)
+const unsigned int WORKER_MAX_REACTORS = 64; //Reactors attached to a WorkerPool at once
+const unsigned int WORKER_BATCH = 64;        //messages a worker takes from a ring before the next one
+const unsigned int STATS_BATCH_BUCKETS = 12; //power-of-two buckets of events returned by one wait
+const unsigned int STATS_MAX_REACTORS = 64;  //Reactors exporting their counters per process
+const unsigned int STATS_PUBLISH_MS = 100;   //interval between two exports of the counters
 
 
 //use 16bits integer as bitmask to point out some considering events
@@ -34,9 +63,75 @@ typedef enum {
               POLL_DEMUX,   //traditional poll() function
               DEVPOLL_DEMUX,  //Solaris /dev/poll facility
               EPOLL_DEMUX,  //Linux epoll() function set
-              KQUEUE_DEMUX  //FreeBSD, NetBSD kqueue facility
+              KQUEUE_DEMUX, //FreeBSD, NetBSD kqueue facility
+              IO_URING_DEMUX //Linux io_uring completion interface
 } DemuxType;
 
+//tunables of a Reactor, given to Reactor::instance() or Reactor::create()
+struct ReactorConfig {
+  ReactorConfig() {
+    edge_triggered = false;
+    max_handles = 0;
+    max_events = MAX_EVENTS_PER_WAIT;
+    udp_recv_batch = UDP_RECV_BATCH;
+    udp_connect_threshold = 0;
+    udp_connected_max = 64;
+    tcp_high_watermark = 256*1024;
+    tcp_low_watermark = 64*1024;
+    tcp_out_max = 4*1024*1024;
+    tcp_zerocopy_threshold = 0;
+    accept_batch = 64;
+    recv_huge_pages = false;
+    export_stats = false;
+  }
+
+  //epoll only: register handles with EPOLLET, make sockets non-blocking
+  //and let handlers drain them until EAGAIN
+  bool edge_triggered;
+
+  //handles above this value are refused. Tables grow up to it on demand,
+  //0 means up to the process's descriptor limit (RLIMIT_NOFILE)
+  unsigned int max_handles;
+
+  //maximum number of events retrieved by one epoll_wait() or DP_POLL
+  unsigned int max_events;
+
+  //datagrams received by one recvmmsg(), from 1 to UDP_RECV_BATCH_MAX
+  unsigned int udp_recv_batch;
+
+  //datagrams per second sent to a peer before it gets a connected UDP
+  //socket of its own, 0 disables connected sockets
+  unsigned int udp_connect_threshold;
+
+  //maximum number of connected UDP sockets per listening one
+  unsigned int udp_connected_max;
+
+  //bytes queued on a TCP connection above which TCPStateOVERFLOW is
+  //reported, then TCPStateDRAINED once back to the low watermark
+  size_t tcp_high_watermark;
+  size_t tcp_low_watermark;
+
+  //bytes queued on a TCP connection above which sends are refused
+  size_t tcp_out_max;
+
+  //writes of at least this many bytes use MSG_ZEROCOPY where supported,
+  //0 disables it. Below about 16KB copying is cheaper, see
+  //test/zerocopy_bench
+  size_t tcp_zerocopy_threshold;
+
+  //connections accepted per readiness event of a listening socket, the
+  //rest of the backlog waits for the next loop iteration
+  unsigned int accept_batch;
+
+  //back the TCP receive buffers with huge pages, reserved ones if there
+  //are (vm.nr_hugepages), transparent ones otherwise
+  bool recv_huge_pages;
+
+  //publish the counters every STATS_PUBLISH_MS to a shared file read by
+  //tools/reactor-top. The loop then waits no longer than that interval
+  bool export_stats;
+};
+
 typedef enum {
               TCPStateINIT,
               TCPStateCONNECTED,
@@ -47,7 +142,8 @@ typedef enum {
               TCPStateOVERFLOW,
               TCPStateFDMAX,
               TCPStateRSVD,
-              TCPStateBADDATA
+              TCPStateBADDATA,
+              TCPStateDRAINED  //output queue is back to the low watermark
 } TcpState;
 
 typedef enum {
@@ -64,14 +160,24 @@ typedef void (*ReactorStreamHandleEvent)(Socket socket, TcpState state);
 typedef void (*ReactorDgramHandleRead)(struct sockaddr_in peeraddr, char* message, size_t msglen);
 typedef void (*ReactorDgramHandleEvent)(UdpState state);
 
-//User's callback functions for timer events
-typedef void (*ReactorHandleTimer)();
+//Called once the kernel is done with a buffer given to a zero-copy send
+typedef void (*ReactorBufferRelease)(void* arg);
 
-struct SipMsgBuff{
-  char big_buff[SIP_MSG_MAX_SIZE];
-  bool is_reading_body;
-  int remain_body_len;
+//Work posted to a Reactor from another thread, run by its loop
+typedef void (*ReactorTask)(void* arg);
+
+//A datagram received in a batch, data is only valid during the callback
+struct DgramMessage {
+  struct sockaddr_in peer;
+  char* data;
+  size_t len;
 };
 
+//Optional, gets all datagrams received at once instead of one by one
+typedef void (*ReactorDgramHandleBatch)(DgramMessage* messages, size_t count);
+
+//User's callback functions for timer events
+typedef void (*ReactorHandleTimer)();
+
 
 #endif // COMMON_H_
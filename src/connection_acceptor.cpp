@@ -1,9 +1,18 @@
 #include "connection_acceptor.h"
 #include "tcp_handler.h"
 
-ConnectionAcceptor::ConnectionAcceptor(const InetAddr &addr, Reactor* reactor) {
+ConnectionAcceptor::ConnectionAcceptor(const InetAddr &addr, Reactor* reactor, bool reuse_port) {
   reactor_ = reactor;
-  sock_acceptor_ = new SockAcceptor(addr);
+  sock_acceptor_ = new SockAcceptor(addr, reuse_port);
+
+  //The backlog is drained until EAGAIN, and an edge-triggered
+  //reactor only reports new connections once
+  set_nonblocking(sock_acceptor_->get_handle());
+
+  shed_ = 0;
+  reserve_fd_ = -1;
+  if (!take_reserve())
+    perror("open /dev/null");
 
   //Because connection request from client is also READ_EVENT,
   //so we register the event for this object to Reactor
@@ -14,24 +23,102 @@ ConnectionAcceptor::~ConnectionAcceptor() {
   //Remove this handler from Reactor's Demux table
   reactor_->remove_handler(this, READ_EVENT);
   delete sock_acceptor_;
+  if (reserve_fd_ >= 0)
+    close(reserve_fd_);
 }
 
 /**
  * @brief Handle connection requests from clients.
  */
 void ConnectionAcceptor::handle_event(Socket h, EventType et) {
-  if ((et & READ_EVENT) == READ_EVENT){
+  if ((et & READ_EVENT) != READ_EVENT)
+    return;
+  take_reserve();
+
+  unsigned int batch = reactor_->get_config().accept_batch;
+  for (unsigned int i = 0; i < batch; i++) {
     // Init new SOCK_Stream with invalid handle.
     // It is freed in TcpHandler's destructor
-    SockStream* client = new SockStream();
+    SockStream* client = new (reactor_->get_stream_pool()) SockStream();
 
     // Call accept() to accept connections from clients
     // and set valid handle for SOCK_Stream
-    sock_acceptor_->accept_sock(client);
-    
+    int ret = sock_acceptor_->accept_sock(client, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    reactor_->stats().sys_accept++;
+    if (ret < 0) {
+      int error = errno;
+      delete client;
+      // The client gave up before being accepted
+      if (error == EINTR || error == ECONNABORTED)
+        continue;
+      if (error == EMFILE || error == ENFILE) {
+        if (shed_connection())
+          continue;
+      } else if (error != EAGAIN && error != EWOULDBLOCK) {
+        perror("accept");
+      }
+      return;
+    }
+
     // Freed when client close the connection (FIN is sent)
-    TcpHandler* handler = new TcpHandler(client, reactor_);
+    reactor_->stats().accepts++;
+    // The handler registers itself with the reactor
+    (void) new (reactor_->get_handler_pool()) TcpHandler(client, reactor_);
   }
+
+  // The batch is full and the backlog may not be empty. Level-triggered
+  // demultiplexers report it again, an edge-triggered one must be re-armed
+  if (reactor_->is_edge_triggered())
+    reactor_->modify_handler(this, READ_EVENT);
+}
+
+/**
+ * @brief Open the reserve descriptor unless it is held. Taking it back
+ * after shedding can fail when another thread grabbed the descriptor, so
+ * it is tried again on each accept and each shortage.
+ */
+bool ConnectionAcceptor::take_reserve() {
+  if (reserve_fd_ < 0)
+    reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return reserve_fd_ >= 0;
+}
+
+/**
+ * @brief Out of descriptors: accept the next pending connection with the
+ * reserve one and close it, then take the reserve back. Return false if
+ * there was no connection to shed.
+ */
+bool ConnectionAcceptor::shed_connection() {
+  if (!take_reserve())
+    return false;
+
+  close(reserve_fd_);
+  reserve_fd_ = -1;
+  Socket conn = accept(get_handle(), nullptr, nullptr);
+  reactor_->stats().sys_accept++;
+  if (conn >= 0) {
+    close(conn);
+    shed_++;
+    reactor_->stats().accepts++;
+    reactor_->stats().drops++;
+  }
+  take_reserve();
+  return conn >= 0;
+}
+
+/**
+ * @brief Connection already accepted by a completion-based demultiplexer.
+ */
+void ConnectionAcceptor::handle_accept(Socket conn) {
+  take_reserve();
+  reactor_->stats().accepts++;
+  SockStream* client = new (reactor_->get_stream_pool()) SockStream(conn);
+  // The handler registers itself with the reactor
+  (void) new (reactor_->get_handler_pool()) TcpHandler(client, reactor_);
+}
+
+bool ConnectionAcceptor::is_completion_aware() const {
+  return true;
 }
 
 Socket ConnectionAcceptor::get_handle() const {
@@ -9,22 +9,46 @@
 /**
  * @class ConnectionAcceptor
  *
- * @brief Handle TCP connection requests from clients.
+ * @brief Handle TCP connection requests from clients. Up to
+ * ReactorConfig::accept_batch connections are accepted per event, as
+ * non-blocking sockets.
+ *
+ * A descriptor is kept in reserve for when the process runs out of them:
+ * it is released to accept and close pending connections, which would
+ * otherwise keep the listening socket readable forever.
  */
 class ConnectionAcceptor : public EventHandler {
 public:
-  ConnectionAcceptor(const InetAddr &addr, Reactor* reactor);
+  ConnectionAcceptor(const InetAddr &addr, Reactor* reactor, bool reuse_port=false);
   ~ConnectionAcceptor();
 
   virtual void handle_event(Socket handle, EventType et);
   virtual Socket get_handle() const;
 
+  virtual bool is_completion_aware() const;
+  virtual void handle_accept(Socket conn);
+
+  /**
+   * @brief Connections closed right away for lack of descriptors.
+   */
+  unsigned long shed_count() const {
+    return shed_;
+  }
+
+private:
+  bool take_reserve();
+  bool shed_connection();
+
 private:
   //Socket factory that accepts client connections
   SockAcceptor* sock_acceptor_;
 
   //Cached Reactor
   Reactor* reactor_;
+
+  //Spare descriptor on /dev/null, see shed_connection()
+  int reserve_fd_;
+  unsigned long shed_;
 };
 
 
@@ -1,22 +1,19 @@
 #ifdef HAS_DEV_POLL
 #include "reactor_impl.h"
 
-DevPollReactorImpl::DevPollReactorImpl() {
+#include <iostream>
+
+DevPollReactorImpl::DevPollReactorImpl(const ReactorConfig& config)
+  : table_(resolve_max_handles(config.max_handles)) {
+  max_handles_ = table_.capacity();
   devpollfd_ = open("/dev/poll", O_RDWR);
   if (devpollfd_ < 0) {
     exit(EXIT_FAILURE);
   }
 
-  // Init input array of struct pollfd
-  for (int i = 0; i < MAXFD; i++) {
-    buf_[i].fd = -1;
-    buf_[i].events = 0;
-    buf_[i].revents = 0;
-    handler_[i] = nullptr;
-  }
-
   // Init output array of pollfd has event on
-  output_ = (struct pollfd*) malloc(sizeof(struct pollfd) * MAXFD);
+  max_events_ = config.max_events;
+  output_ = (struct pollfd*) malloc(sizeof(struct pollfd) * max_events_);
 }
 
 DevPollReactorImpl::~DevPollReactorImpl() {
@@ -36,11 +33,13 @@ void DevPollReactorImpl::handle_events(TimeValue* time) {
 
   struct dvpoll dopoll;
   dopoll.dp_timeout = timeout;
-  dopoll.dp_nfds = MAXFD;
+  dopoll.dp_nfds = max_events_;
   dopoll.dp_fds = output_;
 
   // Waiting for events
   nready = ioctl(devpollfd_, DP_POLL, &dopoll);
+  update_time();
+  count_wait(nready);
 
   if (nready < 0) {
     perror("/dev/poll ioctl DP_POLL failed");
@@ -49,20 +48,46 @@ void DevPollReactorImpl::handle_events(TimeValue* time) {
 
   for (i = 0; i < nready; i++) {
     int temp = (output_ + i)->fd;
+    Tuple* slot = table_.find(temp);
 
     if ((output_ + i)->revents & POLLRDNORM) {
-      handler_[temp]->handle_event(temp, READ_EVENT);
+      slot->event_handler->handle_event(temp, READ_EVENT);
     }
     if ((output_ + i)->revents & POLLWRNORM) {
-      handler_[temp]->handle_event(temp, WRITE_EVENT);
+      slot->event_handler->handle_event(temp, WRITE_EVENT);
     }
   }
 }
 
 void DevPollReactorImpl::register_handler(EventHandler* eh, EventType et) {
   int temp = eh->get_handle();
+  Tuple* slot = table_.get(temp);
+  if (slot == nullptr) {
+    std::cout << "Handle " << temp << " is beyond the handler table capacity" << std::endl;
+    return;
+  }
+
+  int i;
+  for (i = 0; i < (int)buf_.size(); i++) {
+    if (buf_[i].fd < 0)
+      break;
+  }
+
+  if (i == (int)buf_.size()) {
+    // Array is full, grow it by a chunk of free entries
+    if (buf_.size() + HANDLE_TABLE_CHUNK > max_handles_) {
+      std::cout << "Too many handles registered to /dev/poll" << std::endl;
+      return;
+    }
+
+    struct pollfd free_entry;
+    free_entry.fd = -1;
+    free_entry.events = 0;
+    free_entry.revents = 0;
+    buf_.resize(buf_.size() + HANDLE_TABLE_CHUNK, free_entry);
+  }
 
-  for (int i = 0; i < MAXFD; i++) {
+  for (; i < (int)buf_.size(); i++) {
     if (buf_[i].fd < 0) {
       buf_[i].fd = eh->get_handle();
       buf_[i].events = 0; //reset events field
@@ -76,15 +101,13 @@ void DevPollReactorImpl::register_handler(EventHandler* eh, EventType et) {
 
       // Handler of a particular descriptor is saved to index has
       // the same value with the descriptor
-      handler_[temp] = eh;
+      slot->event_handler = eh;
+      slot->event_type = et;
+      stats_->handlers++;
       break;
     }
   }
 
-  if (i == MAXFD) {
-    exit(EXIT_FAILURE);
-  }
-
   // Close old mDevpollfd file and open new file rely on new set of pollfds
   close(devpollfd_);
   devpollfd_ = open("/dev/poll", O_RDWR);
@@ -93,8 +116,8 @@ void DevPollReactorImpl::register_handler(EventHandler* eh, EventType et) {
     exit(EXIT_FAILURE);
   }
 
-  if (write(devpollfd_, buf_, (sizeof(struct pollfd) * MAXFD)) != 
-     (sizeof(struct pollfd) * MAXFD) ) {
+  if (write(devpollfd_, &buf_[0], (sizeof(struct pollfd) * buf_.size())) != 
+     (sizeof(struct pollfd) * buf_.size()) ) {
     perror("Failed to write all pollfds");
     close(devpollfd_);
     if (output_ != nullptr) {
@@ -118,15 +141,22 @@ void DevPollReactorImpl::remove_handler(EventHandler* eh, EventType et) {
 void DevPollReactorImpl::remove_handler(Socket h, EventType et) {
 
   // Find the pollfd which has the same file descriptor
-  for (int i = 0; i < MAXFD; i++) {
+  for (int i = 0; i < (int)buf_.size(); i++) {
     if (buf_[i].fd == h) {
       buf_[i].fd = -1;
       buf_[i].events = 0;
-      handler_[h] = nullptr;
       break;
     }
   }
 
+  Tuple* slot = table_.find(h);
+  if (slot != nullptr) {
+    if (slot->event_handler != nullptr)
+      stats_->handlers--;
+    slot->event_handler = nullptr;
+    slot->event_type = 0;
+  }
+
   // Rewrite the /dev/poll
   close(devpollfd_);
   devpollfd_ = open("/dev/poll", O_RDWR);
@@ -135,11 +165,11 @@ void DevPollReactorImpl::remove_handler(Socket h, EventType et) {
     exit(EXIT_FAILURE);
   }
 
-  if (write(devpollfd_, buf_, (sizeof(struct pollfd) * MAXFD)) != 
-     (sizeof(struct pollfd) * MAXFD) ) {
+  if (write(devpollfd_, &buf_[0], (sizeof(struct pollfd) * buf_.size())) != 
+     (sizeof(struct pollfd) * buf_.size()) ) {
     perror("Failed to write all pollfds");
     close(devpollfd_);
-    if (output_ != null) {
+    if (output_ != nullptr) {
       free(output_);
       output_ = nullptr;
     }
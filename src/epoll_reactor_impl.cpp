@@ -1,12 +1,13 @@
 #ifdef HAS_EPOLL
 #include "reactor_impl.h"
 
-EpollReactorImpl::EpollReactorImpl() {
-  for (int i = 0; i < MAXFD; i++) {
-    handler_[i] = nullptr;
-  }
+#include <iostream>
+
+EpollReactorImpl::EpollReactorImpl(const ReactorConfig& config)
+  : events_(config.max_events), table_(resolve_max_handles(config.max_handles)) {
+  edge_triggered_ = config.edge_triggered;
 
-  epollfd_ = epoll_create(MAXFD);
+  epollfd_ = epoll_create1(EPOLL_CLOEXEC);
   if (epollfd_ < 0) {
     perror("epoll_create");
     exit(EXIT_FAILURE);
@@ -14,65 +15,137 @@ EpollReactorImpl::EpollReactorImpl() {
 }
 
 EpollReactorImpl::~EpollReactorImpl() {
+  close(epollfd_);
 }
 
 /**
  * @brief Event handlers register themselves using this method.
- * Note: This class only works well if the file descriptor assigned by kernel 
- * each time a socket is created is lowest one available. It means that
- * it only accepts socket with descriptor number < MAXFD!
+ * Note: Handler table is indexed by descriptor and grows on demand, the
+ * kernel assigns the lowest descriptor available so it stays dense.
+ * Descriptors from ReactorConfig::max_handles on are refused.
  */
 void EpollReactorImpl::register_handler(EventHandler* eh, EventType et) {
-  Socket sockfd = eh->get_handle();
-  if (sockfd >= MAXFD) {
+  register_handler(eh->get_handle(), eh, et);
+}
+
+/**
+ * @brief Register @a eh for handle @a h, which need not be the handler's
+ * own handle.
+ */
+void EpollReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
+  Slot* slot = table_.get(h);
+  if (slot == nullptr) {
+    std::cout << "Handle " << h << " is beyond the handler table capacity" << std::endl;
     return;
   }
-  
-  struct epoll_event add_event;
-  add_event.data.fd = sockfd;
-  add_event.events = 0; // Reset registered events
 
-  if ((et & READ_EVENT) == READ_EVENT)   
-    add_event.events |= EPOLLIN;
-  if ((et & WRITE_EVENT) == WRITE_EVENT)
-    add_event.events |= EPOLLOUT;
-  
-  if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, sockfd, &add_event) < 0) {
-    perror("epoll_ctl ADD");
+  // Events still queued for a former registration of the handle go stale
+  slot->gen++;
+  slot->queued = false;
+  if (!control(EPOLL_CTL_ADD, slot, h, et))
     return;
-  }
-  handler_[sockfd] = eh;
+  if (slot->handler == nullptr)
+    stats_->handlers++;
+  slot->handler = eh;
+  slot->event_type = slot->armed = et;
 }
 
-void EpollReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
-  // Temporarily unavailable
-  std::cout << "Method is not implemented!" << std::endl;
+/**
+ * @brief Update the registration with EPOLL_CTL_MOD.
+ */
+void EpollReactorImpl::modify_handler(EventHandler* eh, EventType et) {
+  Socket sockfd = eh->get_handle();
+  Slot* slot = table_.find(sockfd);
+  if (slot == nullptr || slot->handler != eh) {
+    register_handler(eh, et);
+    return;
+  }
+
+  if (control(EPOLL_CTL_MOD, slot, sockfd, et))
+    slot->event_type = slot->armed = et;
 }
 
-void EpollReactorImpl::remove_handler(EventHandler* eh, EventType et) {
+/**
+ * @brief Record the events wanted, the registration is updated by
+ * apply_changes(). A handler adding WRITE_EVENT and dropping it again
+ * within one loop iteration costs no system call.
+ */
+void EpollReactorImpl::modify_interest(EventHandler* eh, EventType et) {
   Socket sockfd = eh->get_handle();
-  if (sockfd >= MAXFD) {
+  Slot* slot = table_.find(sockfd);
+  if (slot == nullptr || slot->handler != eh) {
+    register_handler(eh, et);
     return;
   }
-  
-  struct epoll_event rm_event;
-  rm_event.data.fd = sockfd;
+
+  slot->event_type = et;
+  if (!slot->queued && et != slot->armed) {
+    slot->queued = true;
+    changes_.push_back(sockfd);
+  }
+}
+
+/**
+ * @brief Update the registrations changed by modify_interest() since the
+ * last wait, skipping those back to their registered events.
+ */
+void EpollReactorImpl::apply_changes() {
+  for (size_t i = 0; i < changes_.size(); i++) {
+    Slot* slot = table_.find(changes_[i]);
+    // Removed, or registered again, since it was queued
+    if (slot == nullptr || !slot->queued)
+      continue;
+
+    slot->queued = false;
+    if (slot->event_type != slot->armed &&
+        control(EPOLL_CTL_MOD, slot, changes_[i], slot->event_type))
+      slot->armed = slot->event_type;
+  }
+  changes_.clear();
+}
+
+bool EpollReactorImpl::control(int op, Slot* slot, Socket h, EventType et) {
+  struct epoll_event event;
+  event.data.u64 = make_data(h, slot->gen);
+  event.events = 0;
   if ((et & READ_EVENT) == READ_EVENT)
-    rm_event.events |= EPOLLIN;
+    event.events |= EPOLLIN;
   if ((et & WRITE_EVENT) == WRITE_EVENT)
-    rm_event.events |= EPOLLOUT;
-
-  if (epoll_ctl(epollfd_, EPOLL_CTL_DEL, sockfd, &rm_event) < 0) {
-    perror("epoll_ctl DEL");
-    return;
+    event.events |= EPOLLOUT;
+  if (edge_triggered_)
+    event.events |= EPOLLET | EPOLLRDHUP;
+
+  stats_->sys_ctl++;
+  if (epoll_ctl(epollfd_, op, h, &event) < 0) {
+    perror(op == EPOLL_CTL_ADD ? "epoll_ctl ADD" : "epoll_ctl MOD");
+    return false;
   }
+  return true;
+}
 
-  handler_[sockfd] = nullptr;
+void EpollReactorImpl::remove_handler(EventHandler* eh, EventType et) {
+  remove_handler(eh->get_handle(), et);
 }
 
 void EpollReactorImpl::remove_handler(Socket h, EventType et) {
-  // Temporarily unavailable
-  std::cout << "Method is not implemented!" << std::endl;
+  Slot* slot = table_.find(h);
+  if (slot == nullptr || slot->handler == nullptr) {
+    return;
+  }
+
+  // The events argument is ignored by EPOLL_CTL_DEL
+  struct epoll_event rm_event = epoll_event();
+  stats_->sys_ctl++;
+  if (epoll_ctl(epollfd_, EPOLL_CTL_DEL, h, &rm_event) < 0)
+    perror("epoll_ctl DEL");
+
+  // A handle closed before being removed is already gone from the epoll
+  // set, the slot is released all the same
+  slot->handler = nullptr;
+  stats_->handlers--;
+  slot->event_type = slot->armed = 0;
+  slot->queued = false;
+  slot->gen++;
 }
 
 /**
@@ -89,31 +162,88 @@ void EpollReactorImpl::handle_events(TimeValue* time) {
     timeout = (time->tv_sec)*1000 + (time->tv_usec)/1000;
   }
 
-  nevents = epoll_wait(epollfd_, events_, MAXFD, timeout);
+  if (!changes_.empty())
+    apply_changes();
+
+  nevents = epoll_wait(epollfd_, &events_[0], events_.size(), timeout);
+  update_time();
+  count_wait(nevents);
   if (nevents < 0) {
     perror("epoll_wait");
     return;
   }
 
+  // Slots and handlers are spread over the heap. The slot of an event is
+  // fetched two events ahead, its handler one event ahead, by which time
+  // the slot is in cache
+  if (nevents > 1)
+    __builtin_prefetch(table_.at((unsigned int)events_[1].data.u64));
   for (int i = 0; i < nevents; i++) {
-    temp = events_[i].data.fd;
-    if ((events_[i].events & EPOLLIN) == EPOLLIN)
-      handler_[temp]->handle_event(temp, READ_EVENT);
-
-    //////////////////////////////////////////////////////////////////////////////////////////
-    //NOTE: be careful in following case
-    // - EventHandler register both EPOLLIN and EPOLLOUT event
-    // - Client associated with that EventHandler close connection
-    // - EPOLLIN & EPOLLOUT events return from epoll_wait()
-    // - Upon processing EPOLLIN event, we free EventHandler (because connection is closed)
-    // and set mHandler[i] to NULL.
-    // - Afterward, EPOLLOUT event is processed, mHandleEvent() is call,
-    // but mHandler[i] now = NULL, so this cause SEGMENTATION FAULT !!!!!!
-    //
-    // =>> One solution is: Process EPOLLOUT first, before EPOLLIN is processed.
-    //////////////////////////////////////////////////////////////////////////////////////////
-    if ((events_[i].events & EPOLLOUT) == EPOLLOUT)
-      handler_[temp]->handle_event(temp, WRITE_EVENT);
+    unsigned long long data = events_[i].data.u64;
+    unsigned int revents = events_[i].events;
+    temp = (Socket)(unsigned int)data;
+    unsigned int gen = (unsigned int)(data >> 32);
+    Slot* slot = table_.at((unsigned int)data);
+
+    if (i + 2 < nevents)
+      __builtin_prefetch(table_.at((unsigned int)events_[i + 2].data.u64));
+    if (i + 1 < nevents) {
+      Slot* next = table_.at((unsigned int)events_[i + 1].data.u64);
+      if (next != nullptr && next->handler != nullptr)
+        __builtin_prefetch(next->handler);
+    }
+
+    // Removed, or the handle closed and registered again, by a handler
+    // dispatched earlier in this batch
+    if (slot == nullptr || slot->gen != gen)
+      continue;
+
+    // Connection is gone, there is nothing worth reading. epoll reports
+    // a hang-up whatever the events registered, so it is dispatched even
+    // to a handle waiting for nothing, which level-triggered mode would
+    // otherwise report for ever
+    if (revents & EPOLLHUP) {
+      slot->handler->handle_event(temp, CLOSE_EVENT);
+      continue;
+    }
+
+    // Events dropped by modify_interest() may still be registered, only
+    // the readiness bits are masked
+    if ((slot->event_type & READ_EVENT) == 0)
+      revents &= ~EPOLLIN;
+    if ((slot->event_type & WRITE_EVENT) == 0)
+      revents &= ~EPOLLOUT;
+
+    // An error alone may only be the error queue, e.g. zero-copy
+    // completions, the handler tells whether the connection is gone
+    if ((revents & (EPOLLERR | EPOLLIN)) == EPOLLERR) {
+      slot->handler->handle_event(temp, EXCEPT_EVENT);
+      if (slot->gen == gen && (revents & EPOLLOUT) == EPOLLOUT)
+        slot->handler->handle_event(temp, WRITE_EVENT);
+      continue;
+    }
+
+    if (edge_triggered_) {
+      if (revents & EPOLLERR) {
+        slot->handler->handle_event(temp, CLOSE_EVENT);
+        continue;
+      }
+
+      // Peer closed its side, pending data is read along with the close
+      if (revents & EPOLLRDHUP) {
+        slot->handler->handle_event(temp, READ_EVENT | CLOSE_EVENT);
+        continue;
+      }
+    }
+
+    if ((revents & EPOLLIN) == EPOLLIN)
+      slot->handler->handle_event(temp, READ_EVENT);
+
+    // The handler may have removed itself while reading, e.g. because the
+    // peer closed the connection: the generation tells before EPOLLOUT is
+    // dispatched to it
+    if ((revents & EPOLLOUT) == EPOLLOUT && slot->gen == gen)
+      slot->handler->handle_event(temp, WRITE_EVENT);
   }
 }
 
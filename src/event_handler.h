@@ -1,6 +1,8 @@
 #ifndef EVENT_HANDLER_H_
 #define EVENT_HANDLER_H_
 
+#include <netinet/in.h>
+
 #include "common.h"
 
 /**
@@ -10,12 +12,55 @@
  */
 class EventHandler {
 public:
+  virtual ~EventHandler() {
+  }
+
   // NOTE: may be we don't need "handle" parameter in mHandleEvent()
   // because when mHandleEvent() called, it can get associated socket
   // descriptor through SOCK_Acceptor or SOCK_Stream or SOCK_Datagram
   virtual void handle_event(Socket handle, EventType et) = 0;
 
   virtual Socket get_handle() const = 0;
+
+  // Completion-based demultiplexers (io_uring) perform accept()/recv()
+  // themselves and hand the result over through the methods below instead
+  // of reporting readiness through handle_event(). Readiness-based
+  // demultiplexers never call them.
+
+  /**
+   * @brief Whether this handler consumes completed I/O via handle_accept()
+   * and handle_input(). Otherwise it is only notified about readiness.
+   */
+  virtual bool is_completion_aware() const {
+    return false;
+  }
+
+  /**
+   * @brief A connection was accepted on the listening handle.
+   */
+  virtual void handle_accept(Socket conn) {
+  }
+
+  /**
+   * @brief Data was received on the handle. @a data is only valid until
+   * this method returns, @a peer is set for datagram sockets only.
+   */
+  virtual void handle_input(Socket handle, char* data, size_t len,
+                            struct sockaddr_in* peer) {
+  }
+
+  /**
+   * @brief A datagram larger than the receive buffer was dropped.
+   */
+  virtual void handle_truncated(Socket handle) {
+  }
+
+  /**
+   * @brief Called once at the end of the loop iteration after the handler
+   * asked for it with Reactor::defer_flush(), to write what it queued.
+   */
+  virtual void handle_flush() {
+  }
 };
 
 
@@ -0,0 +1,507 @@
+/**
+ * @brief This is implementation of Reactor with Linux's io_uring interface.
+ * The rings are set up with raw system calls, so liburing is not required.
+ * Note: user_data of each submission encodes the handle it was issued for:
+ *          bits  0-31: socket descriptor
+ *          bits 32-39: operation kind (OP_*)
+ *          bits 40-63: generation of the handle's slot
+ *       A completion whose generation does not match its slot belongs to
+ *       a handler which has already been removed and is dropped.
+ */
+#ifdef HAS_IO_URING
+#include "reactor_impl.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <iostream>
+
+// Buffer group id of the provided buffer ring
+static const unsigned short URING_BGID = 0;
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                          unsigned int flags, void* arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUringReactorImpl::IoUringReactorImpl(const ReactorConfig& config)
+  : slots_(resolve_max_handles(config.max_handles)) {
+  pending_ = 0;
+
+  struct io_uring_params params;
+  memset(&params, 0x00, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP;
+
+  ringfd_ = io_uring_setup(URING_QUEUE_DEPTH, &params);
+  if (ringfd_ < 0) {
+    perror("io_uring_setup");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    // Needed to wait for completions with a timeout
+    std::cout << "io_uring: kernel does not support IORING_FEAT_EXT_ARG" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // Map submission and completion rings
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_ring_size_ > sq_ring_size_)
+      sq_ring_size_ = cq_ring_size_;
+    cq_ring_size_ = sq_ring_size_;
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    perror("mmap SQ ring");
+    exit(EXIT_FAILURE);
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      perror("mmap CQ ring");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  sqes_ = (struct io_uring_sqe*) mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+                                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      ringfd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    perror("mmap SQEs");
+    exit(EXIT_FAILURE);
+  }
+
+  char* sq = (char*) sq_ring_;
+  sq_head_ = (unsigned int*)(sq + params.sq_off.head);
+  sq_tail_ = (unsigned int*)(sq + params.sq_off.tail);
+  sq_array_ = (unsigned int*)(sq + params.sq_off.array);
+  sq_mask_ = *(unsigned int*)(sq + params.sq_off.ring_mask);
+  sq_entries_ = *(unsigned int*)(sq + params.sq_off.ring_entries);
+
+  char* cq = (char*) cq_ring_;
+  cq_head_ = (unsigned int*)(cq + params.cq_off.head);
+  cq_tail_ = (unsigned int*)(cq + params.cq_off.tail);
+  cq_mask_ = *(unsigned int*)(cq + params.cq_off.ring_mask);
+  cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  // Register the buffer ring that multishot receives pick their buffers from
+  buf_ring_ = (struct io_uring_buf_ring*) mmap(nullptr, URING_BUF_COUNT * sizeof(struct io_uring_buf),
+                                               PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  bufs_ = (char*) mmap(nullptr, (size_t)URING_BUF_COUNT * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring_ == MAP_FAILED || bufs_ == MAP_FAILED) {
+    perror("mmap buffer ring");
+    exit(EXIT_FAILURE);
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0x00, sizeof(reg));
+  reg.ring_addr = (unsigned long) buf_ring_;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BGID;
+  if (io_uring_register(ringfd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("io_uring_register PBUF_RING");
+    exit(EXIT_FAILURE);
+  }
+
+  buf_ring_->tail = 0;
+  for (unsigned int i = 0; i < URING_BUF_COUNT; i++) {
+    recycle_buffer(i);
+  }
+}
+
+IoUringReactorImpl::~IoUringReactorImpl() {
+  munmap(bufs_, (size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+  munmap(buf_ring_, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+  munmap(sqes_, sq_entries_ * sizeof(struct io_uring_sqe));
+  if (cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  munmap(sq_ring_, sq_ring_size_);
+  close(ringfd_);
+}
+
+unsigned long long IoUringReactorImpl::make_user_data(Socket h, int op, unsigned int gen) {
+  return ((unsigned long long)(gen & 0xFFFFFF) << 40) |
+    ((unsigned long long)(op & 0xFF) << 32) | (unsigned int)h;
+}
+
+/**
+ * @brief Hand a provided buffer back to the kernel. It needs no system call,
+ * the kernel picks it up from the ring on the next receive.
+ */
+void IoUringReactorImpl::recycle_buffer(unsigned short bid) {
+  unsigned short tail = buf_ring_->tail;
+  // Index the ring as a plain array: in C++ the flexible array member
+  // "bufs" of the kernel header does not start at offset 0.
+  struct io_uring_buf* buf = (struct io_uring_buf*)buf_ring_ + (tail & (URING_BUF_COUNT - 1));
+  buf->addr = (unsigned long)(bufs_ + (size_t)bid * URING_BUF_SIZE);
+  buf->len = URING_BUF_SIZE;
+  buf->bid = bid;
+  __atomic_store_n(&buf_ring_->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get a free submission queue entry. Entries are only submitted
+ * in handle_events(), unless the submission queue is full.
+ */
+struct io_uring_sqe* IoUringReactorImpl::get_sqe() {
+  unsigned int tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+    stats_->sys_ctl++;
+    if (io_uring_enter(ringfd_, pending_, 0, 0, nullptr, 0) < 0) {
+      perror("io_uring_enter");
+      return nullptr;
+    }
+    pending_ = 0;
+  }
+
+  unsigned int index = tail & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0x00, sizeof(*sqe));
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  pending_++;
+  return sqe;
+}
+
+/**
+ * @brief Queue a multishot operation of the given kind on a handle.
+ */
+void IoUringReactorImpl::arm(Socket h, int op) {
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr)
+    return;
+
+  Slot& slot = *slots_.find(h);
+  sqe->fd = h;
+  sqe->user_data = make_user_data(h, op, slot.gen);
+
+  switch (op) {
+  case OP_ACCEPT:
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    break;
+  case OP_RECV:
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    break;
+  case OP_RECVMSG:
+    memset(&slot.msg, 0x00, sizeof(slot.msg));
+    slot.msg.msg_namelen = sizeof(struct sockaddr_in);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (unsigned long)&slot.msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    break;
+  case OP_POLL_IN:
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    break;
+  case OP_POLL_OUT:
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLOUT;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    break;
+  default:
+    break;
+  }
+
+  slot.armed |= op;
+}
+
+/**
+ * @brief Queue cancellation of an operation in flight. The cancelled
+ * operation still posts a completion, which is dropped as stale.
+ */
+void IoUringReactorImpl::cancel(Socket h, int op) {
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr)
+    return;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  Slot& slot = *slots_.find(h);
+  sqe->addr = make_user_data(h, op, slot.gen);
+  sqe->user_data = make_user_data(h, OP_CANCEL, 0);
+  slot.armed &= ~op;
+}
+
+void IoUringReactorImpl::register_handler(EventHandler* eh, EventType et) {
+  register_handler(eh->get_handle(), eh, et);
+}
+
+/**
+ * @brief Choose the operation for READ_EVENT from the kind of socket:
+ * listening sockets are accepted, stream and datagram sockets are received
+ * into provided buffers. Handlers which are not completion aware and
+ * non-socket handles are polled for readiness.
+ */
+void IoUringReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
+  Slot* entry = slots_.get(h);
+  if (entry == nullptr) {
+    std::cout << "Handle " << h << " is beyond the handler table capacity" << std::endl;
+    return;
+  }
+
+  Slot& slot = *entry;
+  if (slot.handler != nullptr) {
+    remove_handler(h, et);
+  }
+
+  slot.handler = eh;
+  slot.gen++;
+  slot.armed = 0;
+  stats_->handlers++;
+  slot.read_op = OP_POLL_IN;
+
+  if (eh->is_completion_aware()) {
+    int val;
+    socklen_t len = sizeof(val);
+    if (getsockopt(h, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val != 0) {
+      slot.read_op = OP_ACCEPT;
+    } else {
+      len = sizeof(val);
+      if (getsockopt(h, SOL_SOCKET, SO_TYPE, &val, &len) == 0) {
+        if (val == SOCK_STREAM)
+          slot.read_op = OP_RECV;
+        else if (val == SOCK_DGRAM)
+          slot.read_op = OP_RECVMSG;
+      }
+    }
+  }
+
+  if ((et & READ_EVENT) == READ_EVENT)
+    arm(h, slot.read_op);
+  if ((et & WRITE_EVENT) == WRITE_EVENT)
+    arm(h, OP_POLL_OUT);
+}
+
+/**
+ * @brief Arm or cancel only the operations which change. Unlike removing
+ * and registering again, this keeps the generation, so completions of the
+ * receive in flight are not dropped as stale.
+ */
+void IoUringReactorImpl::modify_handler(EventHandler* eh, EventType et) {
+  Slot* entry = slots_.find(eh->get_handle());
+  if (entry == nullptr || entry->handler != eh) {
+    register_handler(eh, et);
+    return;
+  }
+
+  Socket h = eh->get_handle();
+  Slot& slot = *entry;
+  bool want_read = (et & READ_EVENT) == READ_EVENT;
+  bool want_write = (et & WRITE_EVENT) == WRITE_EVENT;
+
+  if (want_read && !(slot.armed & slot.read_op))
+    arm(h, slot.read_op);
+  else if (!want_read && (slot.armed & slot.read_op))
+    cancel(h, slot.read_op);
+
+  if (want_write && !(slot.armed & OP_POLL_OUT))
+    arm(h, OP_POLL_OUT);
+  else if (!want_write && (slot.armed & OP_POLL_OUT))
+    cancel(h, OP_POLL_OUT);
+}
+
+void IoUringReactorImpl::remove_handler(EventHandler* eh, EventType et) {
+  remove_handler(eh->get_handle(), et);
+}
+
+/**
+ * @brief Cancel everything in flight on the handle. Multishot operations
+ * hold a reference to the socket, so this must be done before it is closed
+ * for the connection to be really released.
+ */
+void IoUringReactorImpl::remove_handler(Socket h, EventType et) {
+  Slot* entry = slots_.find(h);
+  if (entry == nullptr) {
+    return;
+  }
+
+  Slot& slot = *entry;
+  for (int op = OP_ACCEPT; op < OP_CANCEL; op <<= 1) {
+    if (slot.armed & op)
+      cancel(h, op);
+  }
+  if (slot.handler != nullptr)
+    stats_->handlers--;
+  slot.handler = nullptr;
+  slot.gen++;
+}
+
+/**
+ * @brief Submit queued entries and wait for at least one completion,
+ * both in a single io_uring_enter().
+ */
+int IoUringReactorImpl::submit_and_wait(TimeValue* time) {
+  unsigned int min_complete = 1;
+  if (__atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_) {
+    // Completions are already waiting, do not block
+    min_complete = 0;
+  }
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0x00, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if (time != nullptr) {
+    ts.tv_sec = time->tv_sec;
+    ts.tv_nsec = time->tv_usec * 1000;
+    arg.ts = (unsigned long)&ts;
+  }
+
+  int ret = io_uring_enter(ringfd_, pending_, min_complete,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  if (ret >= 0) {
+    pending_ -= ret;
+  }
+  return ret;
+}
+
+/**
+ * @brief Waiting for completions, then dispatch them to event handlers.
+ */
+void IoUringReactorImpl::handle_events(TimeValue* time) {
+  int ret = submit_and_wait(time);
+  update_time();
+  if (ret < 0 && errno != ETIME && errno != EINTR) {
+    perror("io_uring_enter");
+    return;
+  }
+
+  unsigned int head = *cq_head_;
+  unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  count_wait(ret < 0 ? -1 : (int)(tail - head));
+  for (; head != tail; head++) {
+    dispatch(&cqes_[head & cq_mask_]);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Dispatch one completion to its event handler and re-arm the
+ * multishot operation if the kernel terminated it.
+ */
+void IoUringReactorImpl::dispatch(struct io_uring_cqe* cqe) {
+  Socket h = (Socket)(cqe->user_data & 0xFFFFFFFF);
+  int op = (int)((cqe->user_data >> 32) & 0xFF);
+  unsigned int gen = (unsigned int)(cqe->user_data >> 40);
+  int res = cqe->res;
+  bool has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+  unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (op == OP_CANCEL)
+    return;
+
+  Slot* entry = slots_.find(h);
+  if (entry == nullptr || entry->handler == nullptr || (entry->gen & 0xFFFFFF) != gen ||
+      res == -ECANCELED) {
+    // Handler was removed while this operation was in flight, or the
+    // operation was cancelled by modify_handler() and may be armed again
+    if (has_buffer)
+      recycle_buffer(bid);
+    return;
+  }
+
+  Slot& slot = *entry;
+  EventHandler* eh = slot.handler;
+  bool rearm = true;
+  switch (op) {
+  case OP_ACCEPT:
+    if (res >= 0)
+      eh->handle_accept(res);
+    else if (res == -EMFILE || res == -ENFILE)
+      // Out of descriptors, the handler sheds pending connections itself
+      eh->handle_event(h, READ_EVENT);
+    else if (res != -EAGAIN && res != -ECONNABORTED && res != -ECANCELED)
+      std::cout << "io_uring accept: " << strerror(-res) << std::endl;
+    break;
+
+  case OP_RECV:
+    if (res > 0) {
+      eh->handle_input(h, bufs_ + (size_t)bid * URING_BUF_SIZE, res, nullptr);
+    } else if (res == 0 || (res != -ENOBUFS && res != -ECANCELED)) {
+      // Peer closed the connection or the connection failed
+      eh->handle_event(h, CLOSE_EVENT);
+    }
+    break;
+
+  case OP_RECVMSG:
+    if (res > 0) {
+      char* buf = bufs_ + (size_t)bid * URING_BUF_SIZE;
+      struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*) buf;
+      char* payload = buf + sizeof(*out) + slot.msg.msg_namelen + slot.msg.msg_controllen;
+      size_t len = res - (payload - buf);
+      // Truncated datagrams are dropped like with recvfrom()
+      if (out->flags & MSG_TRUNC) {
+        stats_->truncations++;
+        eh->handle_truncated(h);
+      } else if (out->namelen <= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in peer;
+        memcpy(&peer, buf + sizeof(*out), sizeof(peer));
+        eh->handle_input(h, payload, len, &peer);
+      }
+    } else if (res < 0 && res != -ENOBUFS) {
+      // A pending error, e.g. a port unreachable on a connected socket,
+      // is fetched by the handler and the receive armed again. Errors of
+      // the socket itself would only repeat, it is left disarmed
+      if (res == -EBADF || res == -ENOTSOCK || res == -EINVAL || res == -EOPNOTSUPP) {
+        std::cout << "io_uring recvmsg: " << strerror(-res) << std::endl;
+        rearm = false;
+      }
+      eh->handle_event(h, EXCEPT_EVENT);
+    }
+    break;
+
+  case OP_POLL_IN:
+    if (res > 0 && (res & (POLLIN | POLLHUP | POLLERR)))
+      eh->handle_event(h, READ_EVENT);
+    break;
+
+  case OP_POLL_OUT:
+    if (res > 0 && (res & POLLOUT))
+      eh->handle_event(h, WRITE_EVENT);
+    break;
+
+  default:
+    break;
+  }
+
+  if (has_buffer)
+    recycle_buffer(bid);
+
+  // Handler might have removed itself while processing the completion
+  if (cqe->flags & IORING_CQE_F_MORE)
+    return;
+  if (slot.handler != nullptr && (slot.gen & 0xFFFFFF) == gen && (slot.armed & op)) {
+    slot.armed &= ~op;
+    if (rearm)
+      arm(h, op);
+  }
+}
+
+#endif // HAS_IO_URING
@@ -55,12 +55,14 @@ void KqueueReactorImpl::register_handler(EventHandler* eh, EventType et) {
   
   EV_SET(&event, temp, flags, EV_ADD | EV_ENABLE, 0, 0, eh);
 
+  stats_->sys_ctl++;
   if (kevent(kqueue_, &event, 1, NULL, 0, NULL) == -1) {
     perror("kevent() error");
     return;
   }
 
   events_no_++;
+  stats_->handlers++;
 }
 
 void KqueueReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
@@ -82,12 +84,14 @@ void KqueueReactorImpl::remove_handler(EventHandler* eh, EventType et) {
 
   EV_SET(&event, temp, flags, EV_DELETE, 0, 0, 0);
 
+  stats_->sys_ctl++;
   if (kevent(kqueue_, &event, 1, NULL, 0, NULL) == -1) {
     perror("kevent() error");
     return;
   }
 
   events_no_--;
+  stats_->handlers--;
 }
 
 void KqueueReactorImpl::remove_handler(Socket h, EventType et) {
@@ -111,6 +115,8 @@ void KqueueReactorImpl::handle_events(TimeValue* time) {
   }
 
   nevents = kevent(kqueue_, NULL, 0, ev, events_no_, tout);
+  update_time();
+  count_wait(nevents);
   if (nevents < 0) {
     if (tout != nullptr)
       delete tout;
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+
+#include "object_pool.h"
+
+ObjectPool::ObjectPool(size_t object_size) {
+  object_size_ = object_size;
+  stride_ = (HEADER_SIZE + object_size + alignof(max_align_t) - 1) &
+            ~(alignof(max_align_t) - 1);
+  free_ = nullptr;
+  in_use_ = 0;
+}
+
+ObjectPool::~ObjectPool() {
+  for (size_t i = 0; i < slabs_.size(); i++) {
+    free(slabs_[i]);
+  }
+}
+
+/**
+ * @brief Carve a new slab into blocks. They are pushed in reverse so that
+ * the first block is handed out first and the slab is used in order.
+ */
+bool ObjectPool::grow() {
+  char* slab = (char*) malloc(stride_ * POOL_SLAB_OBJECTS);
+  if (slab == nullptr)
+    return false;
+  slabs_.push_back(slab);
+
+  for (size_t i = POOL_SLAB_OBJECTS; i > 0; i--) {
+    Header* block = (Header*)(slab + (i - 1) * stride_);
+    block->owner = this;
+    block->next = free_;
+    free_ = block;
+  }
+  return true;
+}
+
+void* ObjectPool::allocate(ObjectPool* pool, size_t size) {
+  if (pool == nullptr || size > pool->object_size_) {
+    Header* block = (Header*) malloc(HEADER_SIZE + size);
+    if (block == nullptr)
+      return nullptr;
+    block->owner = nullptr;
+    return (char*) block + HEADER_SIZE;
+  }
+
+  if (pool->free_ == nullptr && !pool->grow())
+    return nullptr;
+
+  Header* block = pool->free_;
+  pool->free_ = block->next;
+  pool->in_use_++;
+  return (char*) block + HEADER_SIZE;
+}
+
+void ObjectPool::release(void* p) {
+  if (p == nullptr)
+    return;
+
+  Header* block = (Header*)((char*) p - HEADER_SIZE);
+  ObjectPool* pool = block->owner;
+  if (pool == nullptr) {
+    free(block);
+    return;
+  }
+
+  block->next = pool->free_;
+  pool->free_ = block;
+  pool->in_use_--;
+}
@@ -0,0 +1,85 @@
+#ifndef OBJECT_POOL_H_
+#define OBJECT_POOL_H_
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * @class ObjectPool
+ *
+ * @brief Memory for objects of one size, carved from slabs of
+ * POOL_SLAB_OBJECTS contiguous blocks. Released blocks go on a LIFO free
+ * list, so the memory used last, still in cache, is handed out first.
+ * Slabs are only freed with the pool, which must outlive its objects.
+ * A pool is not thread-safe, it belongs to one Reactor.
+ *
+ * Each block is preceded by a pointer to its pool, so that a class's
+ * operator delete gives it back without knowing where it came from.
+ * Blocks requested from no pool, or larger than the pool's objects (e.g.
+ * a derived class), come from malloc() instead.
+ */
+class ObjectPool {
+public:
+  ObjectPool(size_t object_size);
+  ~ObjectPool();
+
+  /**
+   * @brief Memory for @a size bytes from @a pool, which may be nullptr.
+   * Return nullptr if out of memory.
+   */
+  static void* allocate(ObjectPool* pool, size_t size);
+
+  /**
+   * @brief Give back memory returned by allocate().
+   */
+  static void release(void* p);
+
+  /**
+   * @brief Blocks handed out and not released yet.
+   */
+  size_t in_use() const {
+    return in_use_;
+  }
+
+  /**
+   * @brief Slabs allocated so far, they only grow while more objects
+   * than ever before are in use.
+   */
+  size_t slab_count() const {
+    return slabs_.size();
+  }
+
+private:
+  bool grow();
+
+  struct Header {
+    ObjectPool* owner;
+    Header* next;   // Free list, only while the block is free
+  };
+
+  // Objects start this far from their header, with malloc()'s alignment
+  static const size_t HEADER_SIZE = (sizeof(Header) + alignof(max_align_t) - 1) &
+                                    ~(alignof(max_align_t) - 1);
+
+private:
+  size_t object_size_;
+  size_t stride_;
+  std::vector<char*> slabs_;
+  Header* free_;
+  size_t in_use_;
+};
+
+/**
+ * @brief operator new of pooled classes, throws like the global one.
+ */
+inline void* pool_new(ObjectPool* pool, size_t size) {
+  void* p = ObjectPool::allocate(pool, size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+#endif // OBJECT_POOL_H_
@@ -2,14 +2,9 @@
 
 #include <iostream>
 
-PollReactorImpl::PollReactorImpl() {
-  for (int i = 0; i < MAXFD; i++) {
-    client_[i].fd = -1;
-    client_[i].events = 0;
-    client_[i].revents = 0;
-    handler_[i] = nullptr;
-  }
-  maxi_ = 0;
+PollReactorImpl::PollReactorImpl(const ReactorConfig& config)
+  : index_(resolve_max_handles(config.max_handles)) {
+  max_handles_ = index_.capacity();
 }
 
 PollReactorImpl::~PollReactorImpl() {
@@ -20,85 +15,141 @@ PollReactorImpl::~PollReactorImpl() {
  * to the corresponding event handlers.
  */
 void PollReactorImpl::handle_events(TimeValue* time) {
-  int nready, timeout, i;
+  int nready, timeout;
   if (time == nullptr)
     timeout = -1;
   else
     timeout = (time->tv_sec)*1000 + (time->tv_usec)/1000;
 
-  nready = poll(client_, maxi_+1, timeout);
+  if (client_.empty()) {
+    // Nothing registered yet, just wait for the timeout
+    count_wait(poll(nullptr, 0, timeout));
+    update_time();
+    return;
+  }
+
+  nready = poll(&client_[0], client_.size(), timeout);
+  update_time();
+  count_wait(nready);
   if (nready < 0) {
     perror("poll() error");
     return;
   }
 
-  for (i = 0; i <= maxi_; i++) {
-    if (client_[i].fd < 0)
+  // poll() returns the number of entries with revents set,
+  // so stop as soon as all of them are dispatched
+  size_t i = 0;
+  while (nready > 0 && i < client_.size()) {
+    short revents = client_[i].revents;
+    if (revents == 0) {
+      i++;
       continue;
-    
-    if ((client_[i].revents & POLLRDNORM)) {
-      handler_[i]->handle_event(client_[i].fd, READ_EVENT);
-      if (--nready <= 0)
-        break;
     }
-    
-    if ((client_[i].revents & POLLWRNORM)) {
-      handler_[i]->handle_event(client_[i].fd, WRITE_EVENT);
-      if (--nready <= 0)
-        break;
+
+    Socket fd = client_[i].fd;
+    client_[i].revents = 0;
+    nready--;
+
+    if (revents & (POLLIN | POLLRDNORM)) {
+      handler_[i]->handle_event(fd, READ_EVENT);
+    } else if (revents & POLLHUP) {
+      handler_[i]->handle_event(fd, CLOSE_EVENT);
+    } else if (revents & POLLERR) {
+      // May only be the error queue, the handler tells
+      handler_[i]->handle_event(fd, EXCEPT_EVENT);
+    }
+
+    // A handler removing itself moves the last entry into its place,
+    // which then still has to be dispatched
+    if (i >= client_.size() || client_[i].fd != fd)
+      continue;
+
+    if (revents & POLLWRNORM) {
+      handler_[i]->handle_event(fd, WRITE_EVENT);
+      if (i >= client_.size() || client_[i].fd != fd)
+        continue;
     }
+    i++;
   }
 }
 
 void PollReactorImpl::register_handler(EventHandler* eh, EventType et) {
-  int i;
-  for (i = 0; i < MAXFD; i++) {
-    // First element in array has fd=-1 will be fill
-    // with new handler. Then we break out of for loop
-    if (client_[i].fd == -1) {
-      client_[i].fd = eh->get_handle();
-      client_[i].events = 0; //reset events field
-
-      if ((et & READ_EVENT) == READ_EVENT)
-        client_[i].events |= POLLRDNORM;
-      if ((et & WRITE_EVENT) == WRITE_EVENT)
-        client_[i].events |= POLLWRNORM;
-
-      handler_[i] = eh;
-      break;
-    }
+  register_handler(eh->get_handle(), eh, et);
+}
+
+/**
+ * @brief Append the handle to the pollfd array, or update its events if it
+ * is already there. Index of each handle in the array is kept in index_,
+ * so this does not scan the array.
+ */
+void PollReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
+  int* index = index_.get(h);
+  if (index == nullptr) {
+    std::cout << "Handle " << h << " is beyond the handler table capacity" << std::endl;
+    return;
   }
 
-  if (i == MAXFD) {
-    exit(EXIT_FAILURE);
+  // eventfd only reports POLLIN, sockets report both
+  short events = 0;
+  if ((et & READ_EVENT) == READ_EVENT)
+    events |= POLLIN | POLLRDNORM;
+  if ((et & WRITE_EVENT) == WRITE_EVENT)
+    events |= POLLWRNORM;
+
+  // index_ holds position + 1, 0 means not registered
+  if (*index != 0) {
+    client_[*index - 1].events = events;
+    handler_[*index - 1] = eh;
+    return;
   }
 
-  if (i > maxi_)
-    maxi_ = i;  
+  if (client_.size() >= max_handles_) {
+    std::cout << "Too many handles registered to poll()" << std::endl;
+    return;
+  }
+
+  struct pollfd entry;
+  entry.fd = h;
+  entry.events = events;
+  entry.revents = 0;
+  client_.push_back(entry);
+  handler_.push_back(eh);
+  *index = client_.size();
+  stats_->handlers++;
 }
 
-void PollReactorImpl::register_handler(Socket h, EventHandler* eh, EventType et) {
-  // Temporary unavailable
-  std::cout << "Method is not implemented!" << std::endl;
+/**
+ * @brief Update the events of the handle's pollfd in place, there is no
+ * system call to save.
+ */
+void PollReactorImpl::modify_handler(EventHandler* eh, EventType et) {
+  register_handler(eh->get_handle(), eh, et);
 }
 
 void PollReactorImpl::remove_handler(EventHandler* eh, EventType et) {
-  for (int i = 0; i <= maxi_; i++) {
-    if (client_[i].fd == eh->get_handle()) {
-      client_[i].fd = -1;
-      client_[i].events = 0;
-      handler_[i] = nullptr;
-      break;
-    }
-  }
+  remove_handler(eh->get_handle(), et);
 }
 
+/**
+ * @brief Move the last entry of the pollfd array into the place of the
+ * removed one, so the array stays dense.
+ */
 void PollReactorImpl::remove_handler(Socket h, EventType et) {
-  for (int i = 0; i < maxi_; i++) {
-    if (client_[i].fd == h) {
-      client_[i].fd = -1;
-      handler_[i] = nullptr;
-      break;
-    }
+  int* index = index_.find(h);
+  if (index == nullptr || *index == 0) {
+    return;
+  }
+
+  size_t pos = *index - 1;
+  size_t last = client_.size() - 1;
+  if (pos != last) {
+    client_[pos] = client_[last];
+    handler_[pos] = handler_[last];
+    *index_.find(client_[pos].fd) = pos + 1;
   }
+
+  client_.pop_back();
+  handler_.pop_back();
+  stats_->handlers--;
+  *index = 0;
 }
@@ -1,9 +1,14 @@
+#include <thread>
+
 #include "reactor.h"
 #include "reactor_impl.h"
+#include "tcp_handler.h"
+#include "udp_handler.h"
+#include "task_queue.h"
+#include "worker_pool.h"
 
 Reactor* Reactor::reactor_ = nullptr;
-
-ReactorImpl* Reactor::reactor_impl_ = nullptr;
+thread_local Reactor* Reactor::current_ = nullptr;
 
 /**
  * @brief Delegate to a concrete implementation of Reactor.
@@ -24,15 +29,263 @@ void Reactor::remove_handler(Socket h, EventType et) {
   reactor_impl_->remove_handler(h, et);
 }
 
+void Reactor::modify_handler(EventHandler* eh, EventType et) {
+  reactor_impl_->modify_handler(eh, et);
+}
+
+void Reactor::modify_interest(EventHandler* eh, EventType et) {
+  reactor_impl_->modify_interest(eh, et);
+}
+
+ZerocopyReaper* Reactor::get_zerocopy_reaper() {
+  if (zc_reaper_ == nullptr)
+    zc_reaper_ = new ZerocopyReaper(this);
+  return zc_reaper_;
+}
+
 ReactorImpl* Reactor::get_reactor_impl() {
   return reactor_impl_;
 }
 
+unsigned long long Reactor::now() const {
+  return reactor_impl_->now();
+}
+
+bool Reactor::is_edge_triggered() const {
+  return reactor_impl_->is_edge_triggered();
+}
+
 /**
- * @brief Call to demultiplexer to wait for events.
+ * @brief Call to demultiplexer to wait for events. The wait is cut short
+ * to the earliest timer deadline, so timers need no signal nor thread.
  */
 void Reactor::handle_events(TimeValue* timeout) {
+  current_ = this;
+  stats_.iterations++;
+
+  // Output queued outside of the loop goes out before waiting
+  if (!flush_list_.empty())
+    run_flushes();
+
+  TimeValue wait;
+  unsigned long long next = timers_.next_expiry();
+
+  if (next != ~0ULL) {
+    // Dispatching the previous batch took time since the clock was read
+    reactor_impl_->update_time();
+    unsigned long long now = reactor_impl_->now();
+    unsigned long long delay = (next > now) ? next - now : 0;
+    if (timeout == nullptr ||
+        delay < (unsigned long long)timeout->tv_sec * 1000 + timeout->tv_usec / 1000) {
+      wait.tv_sec = delay / 1000;
+      wait.tv_usec = (delay % 1000) * 1000;
+      timeout = &wait;
+    }
+  }
+
+  // An exporting loop wakes up to publish its counters even when idle, so
+  // a copy much older than STATS_PUBLISH_MS shows a loop stuck in a handler
+  if (stats_slot_ != nullptr &&
+      (timeout == nullptr || (unsigned long long)timeout->tv_sec * 1000 + timeout->tv_usec / 1000 > STATS_PUBLISH_MS)) {
+    wait.tv_sec = STATS_PUBLISH_MS / 1000;
+    wait.tv_usec = (STATS_PUBLISH_MS % 1000) * 1000;
+    timeout = &wait;
+  }
+
+  // Messages the workers had no room for are retried soon
+  if (workers_ != nullptr && workers_->flush(worker_slot_) &&
+      (timeout == nullptr || timeout->tv_sec > 0 || timeout->tv_usec > 1000)) {
+    wait.tv_sec = 0;
+    wait.tv_usec = 1000;
+    timeout = &wait;
+  }
+
   reactor_impl_->handle_events(timeout);
+
+  if (workers_ != nullptr)
+    workers_->flush(worker_slot_);
+
+  if (timers_.size() != 0)
+    timers_.expire(reactor_impl_->now());
+
+  if (!flush_list_.empty())
+    run_flushes();
+
+  if (!delete_list_.empty())
+    run_deletes();
+
+  if (stats_slot_ != nullptr && reactor_impl_->now() - stats_published_ >= STATS_PUBLISH_MS) {
+    stats_published_ = reactor_impl_->now();
+    StatsExport::publish(stats_slot_, stats_, stats_published_);
+  }
+}
+
+bool Reactor::set_worker_pool(WorkerPool* pool) {
+  if (workers_ != nullptr) {
+    // Workers may be waiting for room to post their replies
+    while (!workers_->idle(worker_slot_)) {
+      workers_->flush(worker_slot_);
+      tasks_->handle_event(tasks_->get_handle(), READ_EVENT);
+      std::this_thread::yield();
+    }
+    workers_->detach(worker_slot_);
+    workers_ = nullptr;
+  }
+  if (pool == nullptr)
+    return true;
+
+  worker_slot_ = pool->attach(this);
+  if (worker_slot_ < 0)
+    return false;
+  workers_ = pool;
+  return true;
+}
+
+void Reactor::deliver_stream(Socket h, unsigned long long serial, char* data, size_t len) {
+  if (workers_ != nullptr)
+    workers_->dispatch_stream(worker_slot_, this, h, serial, data, len);
+  else
+    tcp_read_handler_(h, data, len);
+}
+
+void Reactor::deliver_dgram(Socket h, unsigned long long serial, const struct sockaddr_in& peer,
+                            char* data, size_t len) {
+  if (workers_ != nullptr)
+    workers_->dispatch_dgram(worker_slot_, this, h, serial, peer, data, len);
+  else
+    udp_read_handler_(peer, data, len);
+}
+
+bool Reactor::post(ReactorTask task, void* arg) {
+  return tasks_->post(task, arg);
+}
+
+void Reactor::defer_flush(EventHandler* eh) {
+  flush_list_.push_back(eh);
+}
+
+void Reactor::cancel_flush(EventHandler* eh) {
+  for (size_t i = 0; i < flush_list_.size(); i++) {
+    if (flush_list_[i] == eh) {
+      flush_list_.erase(flush_list_.begin() + i);
+      break;
+    }
+  }
+  // It may also be destroyed by another handler being flushed
+  for (size_t i = 0; i < flushing_.size(); i++) {
+    if (flushing_[i] == eh)
+      flushing_[i] = nullptr;
+  }
+}
+
+void Reactor::defer_delete(EventHandler* eh) {
+  delete_list_.push_back(eh);
+}
+
+void Reactor::run_deletes() {
+  // Destructors may close more handlers. Both lists keep their capacity,
+  // so closing connections allocates nothing once they have grown
+  while (!delete_list_.empty()) {
+    deleting_.swap(delete_list_);
+    for (size_t i = 0; i < deleting_.size(); i++) {
+      delete deleting_[i];
+    }
+    deleting_.clear();
+  }
+}
+
+void Reactor::run_flushes() {
+  // Handlers may defer again while flushing, they are served next time
+  flushing_.swap(flush_list_);
+  for (size_t i = 0; i < flushing_.size(); i++) {
+    if (flushing_[i] != nullptr)
+      flushing_[i]->handle_flush();
+  }
+  flushing_.clear();
+}
+
+bool Reactor::send_dgram(const struct sockaddr_in& peer, const char* data, size_t len) {
+  if (dgram_sender_ == nullptr)
+    return false;
+  return dgram_sender_->send(peer, data, len);
+}
+
+bool Reactor::send_stream(Socket h, const char* data, size_t len) {
+  TcpHandler* stream = get_stream(h);
+  if (stream == nullptr)
+    return false;
+  return stream->send(data, len);
+}
+
+bool Reactor::send_file(Socket h, int fd, off_t offset, size_t len,
+                        ReactorBufferRelease release, void* arg) {
+  TcpHandler* stream = get_stream(h);
+  if (stream == nullptr)
+    return false;
+  return stream->send_file(fd, offset, len, release, arg);
+}
+
+void Reactor::set_stream(Socket h, TcpHandler* stream) {
+  if (h < 0)
+    return;
+  if ((size_t)h >= streams_.size()) {
+    if (stream == nullptr)
+      return;
+    streams_.resize(h + 1, nullptr);
+  }
+  streams_[h] = stream;
+}
+
+TcpHandler* Reactor::get_stream(Socket h) const {
+  if (h < 0 || (size_t)h >= streams_.size())
+    return nullptr;
+  return streams_[h];
+}
+
+void Reactor::set_dgram(Socket h, UdpHandler* dgram) {
+  if (h < 0)
+    return;
+  if ((size_t)h >= dgrams_.size()) {
+    if (dgram == nullptr)
+      return;
+    dgrams_.resize(h + 1, nullptr);
+  }
+  dgrams_[h] = dgram;
+}
+
+UdpHandler* Reactor::get_dgram(Socket h) const {
+  if (h < 0 || (size_t)h >= dgrams_.size())
+    return nullptr;
+  return dgrams_[h];
+}
+
+void Reactor::close_streams() {
+  // The destructor leaves the tables, which clears the entry
+  run_deletes();
+  for (size_t h = 0; h < streams_.size(); h++) {
+    if (streams_[h] != nullptr)
+      delete streams_[h];
+  }
+}
+
+TimerId Reactor::schedule_timer(unsigned int delay_ms, TimerCallback cb, void* arg,
+                                unsigned int slack_ms) {
+  if (cb == nullptr)
+    return 0;
+
+  unsigned long long expire = reactor_impl_->now() + delay_ms;
+  if (slack_ms > 0) {
+    // Round down to the largest power of two not above the slack, so that
+    // all timers falling into the same window share one deadline
+    unsigned long long granularity = 1ULL << (63 - __builtin_clzll(slack_ms));
+    expire = (expire + slack_ms) & ~(granularity - 1);
+  }
+
+  return timers_.schedule(expire, cb, arg);
+}
+
+bool Reactor::cancel_timer(TimerId id) {
+  return timers_.cancel(id);
 }
 
 
@@ -41,52 +294,99 @@ void Reactor::handle_events(TimeValue* timeout) {
  * In the first call, need to explicitly indicate which 
  * demultiplexer will be used if it is not SELECT_DEMUX.
  */
-Reactor* Reactor::instance(DemuxType demux) {
+Reactor* Reactor::instance(DemuxType demux, const ReactorConfig& config) {
   if (reactor_ == nullptr) {
-    switch (demux) {
-    case SELECT_DEMUX:
-      reactor_impl_ = new SelectReactorImpl();
-      break;
-    case POLL_DEMUX:
-      reactor_impl_ = new PollReactorImpl();
-      break;
+    // Use "lazy" initialization for Reactor.
+    reactor_ = create(demux, config);
+  }
+
+  return reactor_;
+}
+
+Reactor* Reactor::create(DemuxType demux, const ReactorConfig& config) {
+  // The Reactor registers its task queue with the demultiplexer as soon
+  // as it is constructed
+  ReactorImpl* impl = create_impl(demux, config);
+  if (impl == nullptr)
+    return nullptr;
+  return new Reactor(impl, config);
+}
+
+ReactorImpl* Reactor::create_impl(DemuxType demux, const ReactorConfig& config) {
+  ReactorImpl* impl = nullptr;
+
+  switch (demux) {
+  case SELECT_DEMUX:
+    impl = new SelectReactorImpl();
+    break;
+  case POLL_DEMUX:
+    impl = new PollReactorImpl(config);
+    break;
 
 #if defined (HAS_DEV_POLL)
-    case DEVPOLL_DEMUX:
-      reactor_impl_ = new DevPollReactorImpl();
-      break;
+  case DEVPOLL_DEMUX:
+    impl = new DevPollReactorImpl(config);
+    break;
 #endif // HAS_DEV_POLL
-      
+    
 #if defined (HAS_EPOLL)
-    case EPOLL_DEMUX:
-      reactor_impl_ = new EpollReactorImpl();
-      break;
+  case EPOLL_DEMUX:
+    impl = new EpollReactorImpl(config);
+    break;
 #endif // HAS_EPOLL
-      
+
+#if defined (HAS_IO_URING)
+  case IO_URING_DEMUX:
+    impl = new IoUringReactorImpl(config);
+    break;
+#endif // HAS_IO_URING
+    
 #if defined (HAS_KQUEUE)
-    case KQUEUE_DEMUX:
-      reactor_impl_ = new KqueueReactorImpl();
-      break;
+  case KQUEUE_DEMUX:
+    impl = new KqueueReactorImpl();
+    break;
 #endif // HAS_KQUEUE
-      
-    default:
-      break;
-    }
-
-    // Use "lazy" initialization for Reactor.
-    reactor_ = new Reactor();
+    
+  default:
+    break;
   }
 
-  return reactor_;
+  return impl;
 }
 
-Reactor::Reactor() {
+Reactor::Reactor(ReactorImpl* impl, const ReactorConfig& config)
+  : config_(config), timers_(monotonic_ms()),
+    handler_pool_(sizeof(TcpHandler)), stream_pool_(sizeof(SockStream)),
+    block_pool_(sizeof(TcpHandler::OutBlock)),
+    buffer_pool_(config.recv_huge_pages) {
+  reactor_impl_ = impl;
+  memset(&stats_, 0x00, sizeof(stats_));
+  reactor_impl_->set_stats(&stats_);
   tcp_read_handler_ = nullptr;
   tcp_event_handler_ = nullptr;
   udp_read_handler_ = nullptr;
   udp_event_handler_ = nullptr;
+  udp_batch_handler_ = nullptr;
+  dgram_sender_ = nullptr;
+  zc_reaper_ = nullptr;
+  tasks_ = new TaskQueue(this);
+  workers_ = nullptr;
+  worker_slot_ = -1;
+  serial_ = 0;
+  stats_slot_ = config.export_stats ? StatsExport::acquire() : nullptr;
+  stats_published_ = 0;
 }
 
 Reactor::~Reactor() {
+  if (this == reactor_)
+    reactor_ = nullptr;
+  if (this == current_)
+    current_ = nullptr;
+  set_worker_pool(nullptr);
+  run_deletes();
+  delete zc_reaper_;
+  delete tasks_;
   delete reactor_impl_;
+  if (stats_slot_ != nullptr)
+    StatsExport::release(stats_slot_);
 }
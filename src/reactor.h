@@ -7,12 +7,22 @@
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
+#include <vector>
 
 #include "socket_wf.h"
 #include "common.h"
 #include "event_handler.h"
+#include "timer.h"
+#include "object_pool.h"
+#include "buffer_pool.h"
+#include "reactor_stats.h"
 
 class ReactorImpl;
+class TaskQueue;
+class TcpHandler;
+class UdpHandler;
+class WorkerPool;
+class ZerocopyReaper;
 
 /**
  * @class Reactor
@@ -21,10 +31,11 @@ class ReactorImpl;
  */
 class Reactor {
 protected:
-  Reactor();
-  ~Reactor();
+  Reactor(ReactorImpl* impl, const ReactorConfig& config);
 
 public:
+  virtual ~Reactor();
+
   /**
    * @brief Register callbacks for TCP events.
    */    
@@ -43,33 +54,319 @@ public:
     udp_event_handler_ = event_cb;
   }
 
+  /**
+   * @brief Register a callback receiving all datagrams read by one
+   * recvmmsg() together. When set, it is used instead of the read callback.
+   */
+  virtual void register_udp_batch_callback(ReactorDgramHandleBatch batch_cb) {
+    udp_batch_handler_ = batch_cb;
+  }
+
   virtual void register_handler(EventHandler* eh, EventType et);
   virtual void register_handler(Socket h, EventHandler* eh, EventType et);
 
   virtual void remove_handler(EventHandler* eh, EventType et);
   virtual void remove_handler(Socket h, EventType et);
 
+  /**
+   * @brief Change the events a registered handler waits for, e.g. to add
+   * WRITE_EVENT while output is pending.
+   */
+  virtual void modify_handler(EventHandler* eh, EventType et);
+
+  /**
+   * @brief Change the events a registered handler waits for, as often as
+   * needed while dispatching: the demultiplexer is only updated before it
+   * waits again, and not at all if the events are back to the registered
+   * ones by then. Use modify_handler() to re-arm an edge-triggered handle.
+   */
+  virtual void modify_interest(EventHandler* eh, EventType et);
+
   ReactorImpl* get_reactor_impl();
   
   /* 
-   * @brief Main loop for handling incoming events.
+   * @brief Main loop for handling incoming events. Waits no longer than
+   * @a timeout nor than the earliest timer, then fires the due timers.
    */
   void handle_events(TimeValue* timeout=nullptr);
+
+  /**
+   * @brief Call @a cb with @a arg from handle_events() after @a delay_ms.
+   * The deadline may be pushed back by up to @a slack_ms so that timers
+   * close to each other fire in the same wakeup. Return 0 on failure.
+   */
+  TimerId schedule_timer(unsigned int delay_ms, TimerCallback cb, void* arg,
+                         unsigned int slack_ms=0);
+
+  /**
+   * @brief Return false if the timer already fired or was cancelled.
+   */
+  bool cancel_timer(TimerId id);
+
+  /**
+   * @brief Have @a eh->handle_flush() called once at the end of the current
+   * loop iteration, so that output queued while dispatching is written
+   * with as few system calls as possible.
+   */
+  void defer_flush(EventHandler* eh);
+
+  /**
+   * @brief Forget a deferred flush, e.g. when the handler is destroyed.
+   */
+  void cancel_flush(EventHandler* eh);
+
+  /**
+   * @brief Delete @a eh at the end of the current loop iteration, after the
+   * deferred flushes. A handler closing itself while events are being
+   * dispatched removes its registration and comes here, so its handle is
+   * not reused by a connection accepted later in the same batch and no
+   * code further up the call stack is left with a dangling pointer.
+   */
+  void defer_delete(EventHandler* eh);
+
+  /**
+   * @brief Have @a task called with @a arg by the loop of this Reactor,
+   * e.g. to send a response computed by another thread. This is the only
+   * method which is safe to call from any thread. Tasks run in the order
+   * they are posted, those still queued when the Reactor is destroyed are
+   * dropped. Return false if too many tasks are queued.
+   */
+  bool post(ReactorTask task, void* arg);
+
+  /**
+   * @brief Have the TCP and UDP read callbacks run by @a pool instead of
+   * this thread, nullptr to run them inline again. Call from the thread
+   * of this Reactor. Return false if the pool has no room for it.
+   */
+  bool set_worker_pool(WorkerPool* pool);
+
+  WorkerPool* get_worker_pool() const {
+    return workers_;
+  }
+
+  /**
+   * @brief Hand a received message to the read callback, directly or
+   * through the worker pool. Called by the TCP and UDP handlers.
+   */
+  void deliver_stream(Socket h, unsigned long long serial, char* data, size_t len);
+  void deliver_dgram(Socket h, unsigned long long serial, const struct sockaddr_in& peer,
+                     char* data, size_t len);
+
+  /**
+   * @brief Number telling a TCP connection or UDP socket apart from
+   * earlier ones with the same handle.
+   */
+  unsigned long long next_serial() {
+    return ++serial_;
+  }
+
+  /**
+   * @brief Queue a datagram to @a peer on the UDP socket which received the
+   * last datagram, meant for replies from the UDP callbacks. It is sent at
+   * the end of the loop iteration. Return false if it cannot be queued.
+   */
+  bool send_dgram(const struct sockaddr_in& peer, const char* data, size_t len);
+
+  /**
+   * @brief UDP socket used by send_dgram(). Set by UdpHandler.
+   */
+  void set_dgram_sender(UdpHandler* sender) {
+    dgram_sender_ = sender;
+  }
+
+  UdpHandler* get_dgram_sender() const {
+    return dgram_sender_;
+  }
+
+  /**
+   * @brief Queue @a data on the TCP connection @a h of this Reactor. It is
+   * written at the end of the loop iteration together with everything
+   * else queued on the connection meanwhile. Return false if there is no
+   * such connection or its output queue is full.
+   */
+  bool send_stream(Socket h, const char* data, size_t len);
+
+  /**
+   * @brief Queue @a len bytes of file @a fd from @a offset on the TCP
+   * connection @a h, see TcpHandler::send_file().
+   */
+  bool send_file(Socket h, int fd, off_t offset, size_t len,
+                 ReactorBufferRelease release, void* arg);
+
+  /**
+   * @brief TCP connection of a handle, kept up to date by TcpHandler.
+   */
+  void set_stream(Socket h, TcpHandler* stream);
+  TcpHandler* get_stream(Socket h) const;
+
+  /**
+   * @brief Listening UDP socket of a handle, kept up to date by UdpHandler.
+   */
+  void set_dgram(Socket h, UdpHandler* dgram);
+  UdpHandler* get_dgram(Socket h) const;
+
+  /**
+   * @brief Close every TCP connection of this Reactor, e.g. the ones its
+   * acceptors created, before it is deleted.
+   */
+  void close_streams();
+
+  /**
+   * @brief Reactor whose handle_events() runs on the calling thread, for
+   * callbacks which need to send. nullptr outside of an event loop.
+   */
+  static Reactor* current() {
+    return current_;
+  }
+
+  /**
+   * @brief CLOCK_MONOTONIC time in milliseconds, read when the
+   * demultiplexer returns and again before it waits. Timer delays count
+   * from it.
+   */
+  unsigned long long now() const;
   
-  static Reactor* instance(DemuxType type=SELECT_DEMUX);
+  /**
+   * @brief Process-wide Reactor, created by the first call. nullptr if
+   * @a type is not compiled in on this platform, e.g. DEVPOLL_DEMUX on Linux.
+   */
+  static Reactor* instance(DemuxType type=SELECT_DEMUX,
+                           const ReactorConfig& config=ReactorConfig());
+
+  /**
+   * @brief Create an independent Reactor, e.g. one per thread. It shares
+   * nothing with other instances and is owned by the caller. nullptr if
+   * @a type is not compiled in on this platform.
+   */
+  static Reactor* create(DemuxType type=SELECT_DEMUX,
+                         const ReactorConfig& config=ReactorConfig());
+
+  /**
+   * @brief Whether handles are registered edge-triggered. Handlers must then
+   * use non-blocking sockets and drain them until EAGAIN on each event.
+   */
+  bool is_edge_triggered() const;
+
+  /**
+   * @brief Configuration this Reactor was created with.
+   */
+  const ReactorConfig& get_config() const {
+    return config_;
+  }
+
+  /**
+   * @brief Pools of the TcpHandler and SockStream objects of connections
+   * accepted by this Reactor. Only usable from its own thread.
+   */
+  ObjectPool* get_handler_pool() {
+    return &handler_pool_;
+  }
+
+  ObjectPool* get_stream_pool() {
+    return &stream_pool_;
+  }
+
+  /**
+   * @brief Pool of the nodes of the TCP output queues of this Reactor.
+   */
+  ObjectPool* get_block_pool() {
+    return &block_pool_;
+  }
+
+  /**
+   * @brief Receive buffers of the TCP connections of this Reactor, only
+   * held while a connection has a partial message.
+   */
+  BufferPool* get_buffer_pool() {
+    return &buffer_pool_;
+  }
+
+  /**
+   * @brief Sockets of closed TCP connections waiting for their zero-copy
+   * writes to complete, created on first use.
+   */
+  ZerocopyReaper* get_zerocopy_reaper();
+
+  /**
+   * @brief Counters of this Reactor, incremented by its demultiplexer and
+   * handlers on its own thread only. Other threads and processes read the
+   * copies exported with ReactorConfig::export_stats.
+   */
+  ReactorStats& stats() {
+    return stats_;
+  }
 
 public:
   ReactorStreamHandleRead   tcp_read_handler_;
   ReactorStreamHandleEvent  tcp_event_handler_;
   ReactorDgramHandleRead    udp_read_handler_;
   ReactorDgramHandleEvent   udp_event_handler_;
+  ReactorDgramHandleBatch   udp_batch_handler_;
 
 protected:
+  void run_flushes();
+  void run_deletes();
+
+  static ReactorImpl* create_impl(DemuxType type, const ReactorConfig& config);
+
   /// Implementation of Reactor using Bridge pattern.
-  static ReactorImpl* reactor_impl_;
+  ReactorImpl* reactor_impl_;
+
+  ReactorConfig config_;
+
+  /// Timers of this Reactor, only touched from its own loop.
+  TimingWheel timers_;
+
+  /// Connection objects, recycled from one connection to the next.
+  ObjectPool handler_pool_;
+  ObjectPool stream_pool_;
+
+  /// Nodes of the output queues of the connections.
+  ObjectPool block_pool_;
+
+  /// Receive buffers, shared by connections in turn.
+  BufferPool buffer_pool_;
+
+  /// Closed sockets with zero-copy writes in flight, nullptr until needed.
+  ZerocopyReaper* zc_reaper_;
+
+  /// Tasks posted from other threads.
+  TaskQueue* tasks_;
+
+  /// Runs the read callbacks when set, this Reactor is attached as worker_slot_.
+  WorkerPool* workers_;
+  int worker_slot_;
+  unsigned long long serial_;
+
+  /// Handlers waiting for handle_flush() at the end of the iteration.
+  std::vector<EventHandler*> flush_list_;
+  std::vector<EventHandler*> flushing_;
+
+  /// Handlers closed during the iteration, deleted at its end.
+  std::vector<EventHandler*> delete_list_;
+  std::vector<EventHandler*> deleting_;
+
+  UdpHandler* dgram_sender_;
+
+  /// TCP connections indexed by handle.
+  std::vector<TcpHandler*> streams_;
+
+  /// Listening UDP sockets indexed by handle.
+  std::vector<UdpHandler*> dgrams_;
+
+  /// Counters, written by the loop only, on cache lines of their own.
+  char stats_pad0_[64];
+  ReactorStats stats_;
+  char stats_pad1_[64];
+
+  /// Exported copy of stats_, nullptr unless config_.export_stats.
+  StatsSlot* stats_slot_;
+  unsigned long long stats_published_;
 
   /// Process-wide Reactor singleton.
   static Reactor* reactor_;
+
+  static thread_local Reactor* current_;
 };
 
 
@@ -0,0 +1,169 @@
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+
+#include "reactor_group.h"
+#include "connection_acceptor.h"
+#include "udp_handler.h"
+
+/**
+ * @brief Posted by stop(), it only cuts the wait of a loop short so that
+ * the loop sees it has to stop.
+ */
+static void wake_up(void* arg) {
+}
+
+ReactorGroup::ReactorGroup(unsigned int nthreads, DemuxType demux,
+                           const ReactorConfig& config)
+  : config_(config), stopping_(false) {
+  if (nthreads == 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpus > 0) ? ncpus : 1;
+  }
+  nthreads_ = nthreads;
+  demux_ = demux;
+  ready_ = 0;
+
+  tcp_read_handler_ = nullptr;
+  tcp_event_handler_ = nullptr;
+  udp_read_handler_ = nullptr;
+  udp_event_handler_ = nullptr;
+  udp_batch_handler_ = nullptr;
+  workers_ = nullptr;
+}
+
+ReactorGroup::~ReactorGroup() {
+  stop();
+}
+
+void ReactorGroup::register_tcp_callbacks(ReactorStreamHandleRead read_cb,
+                                          ReactorStreamHandleEvent event_cb) {
+  tcp_read_handler_ = read_cb;
+  tcp_event_handler_ = event_cb;
+}
+
+void ReactorGroup::register_udp_callbacks(ReactorDgramHandleRead read_cb,
+                                          ReactorDgramHandleEvent event_cb) {
+  udp_read_handler_ = read_cb;
+  udp_event_handler_ = event_cb;
+}
+
+void ReactorGroup::register_udp_batch_callback(ReactorDgramHandleBatch batch_cb) {
+  udp_batch_handler_ = batch_cb;
+}
+
+void ReactorGroup::listen_tcp(const InetAddr& addr) {
+  tcp_addrs_.push_back(addr);
+}
+
+void ReactorGroup::listen_udp(const InetAddr& addr) {
+  udp_addrs_.push_back(addr);
+}
+
+void ReactorGroup::start() {
+  if (!threads_.empty())
+    return;
+
+  stopping_ = false;
+  ready_ = 0;
+  reactors_.assign(nthreads_, nullptr);
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    threads_.push_back(std::thread(&ReactorGroup::run, this, i));
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (ready_ < nthreads_) {
+    ready_cond_.wait(lock);
+  }
+}
+
+Reactor* ReactorGroup::get_reactor(unsigned int index) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reactors_[index];
+}
+
+void ReactorGroup::stop() {
+  stopping_ = true;
+  {
+    // A reactor is only deleted once its thread cleared its entry
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < reactors_.size(); i++) {
+      if (reactors_[i] == nullptr)
+        continue;
+      while (!reactors_[i]->post(wake_up, nullptr)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+  threads_.clear();
+}
+
+/**
+ * @brief Body of a reactor thread. The reactor and its handlers are created
+ * by the thread which runs them, so their memory is local to its CPU.
+ */
+void ReactorGroup::run(unsigned int index) {
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpus > 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(index % ncpus, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+      perror("pthread_setaffinity_np");
+  }
+
+  Reactor* reactor = Reactor::create(demux_, config_);
+  if (reactor == nullptr) {
+    fprintf(stderr, "Reactor %u: demultiplexer %d is not available\n", index,
+            static_cast<int>(demux_));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_++;
+    }
+    ready_cond_.notify_one();
+    return;
+  }
+  reactor->register_tcp_callbacks(tcp_read_handler_, tcp_event_handler_);
+  reactor->register_udp_callbacks(udp_read_handler_, udp_event_handler_);
+  reactor->register_udp_batch_callback(udp_batch_handler_);
+  if (workers_ != nullptr && !reactor->set_worker_pool(workers_))
+    fprintf(stderr, "Reactor %u runs its callbacks inline\n", index);
+
+  std::vector<ConnectionAcceptor*> acceptors;
+  for (size_t i = 0; i < tcp_addrs_.size(); i++) {
+    acceptors.push_back(new ConnectionAcceptor(tcp_addrs_[i], reactor, true));
+  }
+
+  std::vector<UdpHandler*> udp_handlers;
+  for (size_t i = 0; i < udp_addrs_.size(); i++) {
+    udp_handlers.push_back(new UdpHandler(udp_addrs_[i], reactor, true));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reactors_[index] = reactor;
+    ready_++;
+  }
+  ready_cond_.notify_one();
+
+  // stop() posts a task to wake the loop up, it needs no timeout
+  while (!stopping_.load(std::memory_order_relaxed)) {
+    reactor->handle_events();
+  }
+
+  for (size_t i = 0; i < acceptors.size(); i++) {
+    delete acceptors[i];
+  }
+  for (size_t i = 0; i < udp_handlers.size(); i++) {
+    delete udp_handlers[i];
+  }
+  reactor->close_streams();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reactors_[index] = nullptr;
+  }
+  delete reactor;
+}
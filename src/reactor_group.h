@@ -0,0 +1,108 @@
+#ifndef REACTOR_GROUP_H_
+#define REACTOR_GROUP_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "socket_wf.h"
+#include "reactor.h"
+#include "worker_pool.h"
+
+/**
+ * @class ReactorGroup
+ *
+ * @brief Run N independent reactors, one per thread, each pinned to a CPU.
+ * Every reactor gets its own ConnectionAcceptor and UdpHandler bound with
+ * SO_REUSEPORT to the same addresses, so the kernel spreads connections
+ * and datagrams across them. Reactors share nothing, a connection is
+ * served by the thread which accepted it until it is closed.
+ */
+class ReactorGroup {
+public:
+  /**
+   * @brief @a nthreads of 0 means one reactor per online CPU. Every
+   * reactor is created with @a config.
+   */
+  ReactorGroup(unsigned int nthreads, DemuxType demux,
+               const ReactorConfig& config=ReactorConfig());
+  ~ReactorGroup();
+
+  /**
+   * @brief Callbacks given to every reactor of the group. They run
+   * concurrently on all reactor threads.
+   */
+  void register_tcp_callbacks(ReactorStreamHandleRead read_cb,
+                              ReactorStreamHandleEvent event_cb);
+  void register_udp_callbacks(ReactorDgramHandleRead read_cb,
+                              ReactorDgramHandleEvent event_cb);
+  void register_udp_batch_callback(ReactorDgramHandleBatch batch_cb);
+
+  /**
+   * @brief Have the read callbacks of every reactor run by @a pool, see
+   * Reactor::set_worker_pool(). Must be called before start(), the pool
+   * must outlive the group.
+   */
+  void set_worker_pool(WorkerPool* pool) {
+    workers_ = pool;
+  }
+
+  /**
+   * @brief Addresses every reactor listens on. Must be called before start().
+   */
+  void listen_tcp(const InetAddr& addr);
+  void listen_udp(const InetAddr& addr);
+
+  /**
+   * @brief Spawn the reactor threads. Returns once all of them are ready.
+   */
+  void start();
+
+  /**
+   * @brief Ask all reactor threads to leave their event loop and wait for them.
+   * Each loop is woken up by a task posted to its reactor.
+   */
+  void stop();
+
+  unsigned int size() const {
+    return nthreads_;
+  }
+
+  /**
+   * @brief Reactor run by the given thread, valid between start() and stop().
+   * nullptr if the thread could not create its reactor.
+   */
+  Reactor* get_reactor(unsigned int index) const;
+
+private:
+  void run(unsigned int index);
+
+private:
+  unsigned int nthreads_;
+  DemuxType demux_;
+  ReactorConfig config_;
+
+  ReactorStreamHandleRead   tcp_read_handler_;
+  ReactorStreamHandleEvent  tcp_event_handler_;
+  ReactorDgramHandleRead    udp_read_handler_;
+  ReactorDgramHandleEvent   udp_event_handler_;
+  ReactorDgramHandleBatch   udp_batch_handler_;
+  WorkerPool* workers_;
+
+  std::vector<InetAddr> tcp_addrs_;
+  std::vector<InetAddr> udp_addrs_;
+
+  std::vector<std::thread> threads_;
+  std::vector<Reactor*> reactors_;
+  std::atomic<bool> stopping_;
+
+  // Guards reactors_, set and cleared by the threads, and ready_
+  mutable std::mutex mutex_;
+  std::condition_variable ready_cond_;
+  unsigned int ready_;
+};
+
+#endif // REACTOR_GROUP_H_
@@ -1,7 +1,24 @@
 #include <iostream>
+#include <sys/resource.h>
+#include <limits.h>
 
 #include "reactor_impl.h"
 
+unsigned int resolve_max_handles(unsigned int max_handles) {
+  if (max_handles != 0)
+    return max_handles;
+
+  // Descriptors are below the limit in force when the reactor is created
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    perror("getrlimit RLIMIT_NOFILE");
+    return FD_SETSIZE;
+  }
+  if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > INT_MAX)
+    return INT_MAX;
+  return limit.rlim_cur;
+}
+
 DemuxTable::DemuxTable() {
   memset(table_, 0x00, FD_SETSIZE * sizeof(struct Tuple));
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <poll.h>
 #include <cstddef>
+#include <vector>
 
 #if defined (HAS_DEV_POLL)
 #include <sys/devpoll.h>
@@ -13,6 +14,11 @@
 #include <sys/epoll.h>
 #endif // HAS_EPOLL
 
+#if defined (HAS_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#endif // HAS_IO_URING
+
 #if defined (HAS_KQUEUE)
 #include <sys/event.h>
 #include <sys/types.h>
@@ -51,6 +57,83 @@ public:
 };
 
 
+/**
+ * @brief Resolve ReactorConfig::max_handles, 0 stands for the process's
+ * descriptor limit.
+ */
+unsigned int resolve_max_handles(unsigned int max_handles);
+
+/**
+ * @brief Table of per-handle slots indexed by file descriptor. Slots are
+ * allocated in chunks of HANDLE_TABLE_CHUNK when a handle in a new range
+ * shows up, so small instances stay small and large ones need no
+ * compile-time limit. Chunks never move: pointers to slots stay valid.
+ * T must be a POD type, new slots are zero-filled.
+ */
+template <class T>
+class HandleTable {
+public:
+  HandleTable(unsigned int capacity) {
+    capacity_ = capacity;
+  }
+
+  ~HandleTable() {
+    for (size_t i = 0; i < chunks_.size(); i++) {
+      free(chunks_[i]);
+    }
+  }
+
+  /**
+   * @brief Slot of the handle, nullptr if no slot was allocated for it.
+   */
+  T* find(Socket h) const {
+    size_t chunk = (unsigned int)h / HANDLE_TABLE_CHUNK;
+    if (h < 0 || chunk >= chunks_.size() || chunks_[chunk] == nullptr)
+      return nullptr;
+    return &chunks_[chunk][h & (HANDLE_TABLE_CHUNK - 1)];
+  }
+
+  /**
+   * @brief Slot at @a index handed back by the kernel, e.g. in an event
+   * registered for a slot from get(). Its chunk exists, so only the index
+   * is checked against the chunks allocated.
+   */
+  T* at(unsigned int index) const {
+    size_t chunk = index / HANDLE_TABLE_CHUNK;
+    if (chunk >= chunks_.size())
+      return nullptr;
+    return &chunks_[chunk][index & (HANDLE_TABLE_CHUNK - 1)];
+  }
+
+  /**
+   * @brief Slot of the handle, allocated if needed. nullptr if the handle
+   * is beyond the capacity of the table.
+   */
+  T* get(Socket h) {
+    if (h < 0 || (unsigned int)h >= capacity_)
+      return nullptr;
+
+    size_t chunk = (unsigned int)h / HANDLE_TABLE_CHUNK;
+    if (chunk >= chunks_.size())
+      chunks_.resize(chunk + 1, nullptr);
+    if (chunks_[chunk] == nullptr) {
+      chunks_[chunk] = (T*) calloc(HANDLE_TABLE_CHUNK, sizeof(T));
+      if (chunks_[chunk] == nullptr)
+        return nullptr;
+    }
+    return &chunks_[chunk][h & (HANDLE_TABLE_CHUNK - 1)];
+  }
+
+  unsigned int capacity() const {
+    return capacity_;
+  }
+
+private:
+  std::vector<T*> chunks_;
+  unsigned int capacity_;
+};
+
+
 /**
  * @brief Interface for Reactor implementations.
  * User MUST register ReactorStreamHandleRead if they use TCP.
@@ -59,6 +142,10 @@ public:
  */
 class ReactorImpl {
 public:
+  ReactorImpl() {
+    now_ = monotonic_ms();
+    stats_ = nullptr;
+  }
   virtual ~ReactorImpl() {}
   
   virtual void register_handler(EventHandler* eh, EventType et) = 0;
@@ -66,6 +153,69 @@ public:
   virtual void remove_handler(EventHandler* eh, EventType et) = 0;
   virtual void remove_handler(Socket h, EventType et) = 0;
   virtual void handle_events(TimeValue* timeout=nullptr) = 0;
+
+  /**
+   * @brief Change the events a registered handler waits for. Backends
+   * which can update a registration in place override this.
+   */
+  virtual void modify_handler(EventHandler* eh, EventType et) {
+    remove_handler(eh, READ_EVENT | WRITE_EVENT | EXCEPT_EVENT);
+    register_handler(eh, et);
+  }
+
+  /**
+   * @brief Like modify_handler(), but the demultiplexer may wait until
+   * just before its next wait to apply the change, and then only if the
+   * events differ from those it already waits for.
+   */
+  virtual void modify_interest(EventHandler* eh, EventType et) {
+    modify_handler(eh, et);
+  }
+
+  virtual bool is_edge_triggered() const {
+    return false;
+  }
+
+  /**
+   * @brief Time the last wait returned, in CLOCK_MONOTONIC milliseconds.
+   */
+  unsigned long long now() const {
+    return now_;
+  }
+
+  /**
+   * @brief Counters of the Reactor, set before any other call.
+   */
+  void set_stats(ReactorStats* stats) {
+    stats_ = stats;
+  }
+
+  /**
+   * @brief Read the clock once per wait, before dispatching, so handlers
+   * and timers share the same loop time. The Reactor reads it again
+   * before waiting, so time spent dispatching shortens the wait.
+   */
+  void update_time() {
+    now_ = monotonic_ms();
+  }
+
+protected:
+  /**
+   * @brief Account for a wait which returned @a n events, -1 on error.
+   */
+  void count_wait(int n) {
+    stats_->sys_wait++;
+    if (n < 0)
+      return;
+    if (n > 0) {
+      stats_->wakeups++;
+      stats_->events += n;
+    }
+    stats_->batch[stats_bucket(n)]++;
+  }
+
+  unsigned long long now_;
+  ReactorStats* stats_;
 };
 
 /**
@@ -91,27 +241,31 @@ private:
 
 /**
  * @brief Use poll() to demultiplex.
+ * client_ only holds registered handles: removal moves the last entry into
+ * the freed place. index_ maps each handle to its position in client_.
  */
 class PollReactorImpl : public ReactorImpl {
 public:
-  PollReactorImpl();
+  PollReactorImpl(const ReactorConfig& config=ReactorConfig());
   ~PollReactorImpl();
 
   void register_handler(EventHandler* eh, EventType et);
   void register_handler(Socket h, EventHandler* eh, EventType et);
   void remove_handler(EventHandler* eh, EventType et);
   void remove_handler(Socket h, EventType et);
+  void modify_handler(EventHandler* eh, EventType et);
   void handle_events(TimeValue* timeout=nullptr);
 
 private:
-  struct pollfd client_[MAXFD];
-  EventHandler* handler_[MAXFD];
-  int maxi_;
+  std::vector<struct pollfd> client_;
+  std::vector<EventHandler*> handler_; // handler_[i] handles client_[i]
+  HandleTable<int> index_; // Position in client_ + 1, 0 if not registered
+  unsigned int max_handles_;
 };
 
 /**
  * @brief Use /dev/poll as demultiplexer. This class is used with Solaris OS.
- * Handler of file descriptor x is handler_[x].
+ * Handler of file descriptor x is the handler in table_ slot x.
  * buf_ is an array contains a list of pollfd struct observed.
  * output_ is output of ioctl() function, containing a list of pollfds
  * on which events occur.
@@ -119,7 +273,7 @@ private:
 #if defined (HAS_DEV_POLL)
 class DevPollReactorImpl : public ReactorImpl {
 public:
-  DevPollReactorImpl();
+  DevPollReactorImpl(const ReactorConfig& config=ReactorConfig());
   ~DevPollReactorImpl();
 
   void register_handler(EventHandler* eh, EventType et);
@@ -130,36 +284,157 @@ public:
 
 private:
   int devpollfd_;
-  struct pollfd buf_[MAXFD]; //input interested file descriptors
+  std::vector<struct pollfd> buf_; //input interested file descriptors
   struct pollfd* output_;    //file descriptors has event
-  EventHandler* handler_[MAXFD]; //keep track of handler for each file descriptor
+  unsigned int max_events_;  //capacity of output_
+  unsigned int max_handles_;
+  HandleTable<Tuple> table_; //keep track of handler for each file descriptor
 };
 
 #endif // HAS_DEV_POLL
 
 /**
  * @brief Use Linux's epoll() as demultiplexer.
+ * EPOLLHUP is dispatched as CLOSE_EVENT without reading the socket, even
+ * to a handle waiting for no event. An EPOLLERR alone, which may only be
+ * the error queue, is dispatched as EXCEPT_EVENT. In edge-triggered mode
+ * other EPOLLERRs are dispatched as CLOSE_EVENT, and EPOLLRDHUP as
+ * READ_EVENT | CLOSE_EVENT, so the handler reads what is left and closes
+ * without waiting for read() to return 0.
+ * epoll_event.data carries the index of the handle's slot, which is the
+ * handle, and the generation of the slot, see make_data(). An event
+ * resolves to its slot with a bounds check alone. Events left in a batch
+ * for a handler removed, or for a handle reused, while the batch is
+ * dispatched are skipped.
+ * modify_interest() only records the events wanted. Handles whose events
+ * changed are queued and updated with EPOLL_CTL_MOD before the next
+ * epoll_wait(), if their events then differ from the registered ones.
  */
 #if defined (HAS_EPOLL)
 class EpollReactorImpl : public ReactorImpl {
 public:
-  EpollReactorImpl();
+  EpollReactorImpl(const ReactorConfig& config=ReactorConfig());
   ~EpollReactorImpl();
 
   void register_handler(EventHandler* eh, EventType et);
   void register_handler(Socket h, EventHandler* eh, EventType et);
   void remove_handler(EventHandler* eh, EventType et);
   void remove_handler(Socket h, EventType et);
+  void modify_handler(EventHandler* eh, EventType et);
+  void modify_interest(EventHandler* eh, EventType et);
   void handle_events(TimeValue* timeout=nullptr);
 
+  bool is_edge_triggered() const {
+    return edge_triggered_;
+  }
+
 private:
+  struct Slot {
+    EventHandler* handler;
+    EventType event_type; // Events wanted by the handler
+    EventType armed;      // Events registered with epoll
+    bool queued;          // In changes_, waiting for apply_changes()
+    unsigned int gen; // Bumped on each (de)registration to detect stale events
+  };
+
+  bool control(int op, Slot* slot, Socket h, EventType et);
+  void apply_changes();
+
+  static unsigned long long make_data(Socket h, unsigned int gen) {
+    return ((unsigned long long)gen << 32) | (unsigned int)h;
+  }
+
+private:
+  bool edge_triggered_;
   int epollfd_;
-  struct epoll_event events_[MAXFD]; // Output from epoll_wait()
-  EventHandler* handler_[MAXFD];
+  std::vector<struct epoll_event> events_; // Output from epoll_wait()
+  HandleTable<Slot> table_;
+  std::vector<Socket> changes_; // Handles whose events may have changed
 };
 
 #endif // HAS_EPOLL
 
+/**
+ * @brief Use Linux's io_uring as demultiplexer.
+ * Listening sockets get a multishot accept, connected and datagram sockets
+ * get a multishot recv/recvmsg which fills buffers from a kernel-provided
+ * buffer ring. Other handles get a multishot poll and are dispatched like
+ * with the readiness-based demultiplexers. Submissions are batched and
+ * flushed by the same io_uring_enter() that waits for completions.
+ */
+#if defined (HAS_IO_URING)
+class IoUringReactorImpl : public ReactorImpl {
+public:
+  IoUringReactorImpl(const ReactorConfig& config=ReactorConfig());
+  ~IoUringReactorImpl();
+
+  void register_handler(EventHandler* eh, EventType et);
+  void register_handler(Socket h, EventHandler* eh, EventType et);
+  void remove_handler(EventHandler* eh, EventType et);
+  void remove_handler(Socket h, EventType et);
+  void modify_handler(EventHandler* eh, EventType et);
+  void handle_events(TimeValue* timeout=nullptr);
+
+private:
+  // Kinds of operation armed on a handle, encoded into user_data
+  enum {
+        OP_ACCEPT = 0x01,
+        OP_RECV = 0x02,
+        OP_RECVMSG = 0x04,
+        OP_POLL_IN = 0x08,
+        OP_POLL_OUT = 0x10,
+        OP_CANCEL = 0x20
+  };
+
+  struct Slot {
+    EventHandler* handler;
+    unsigned int gen; // Bumped on each (de)registration to detect stale completions
+    int read_op;      // Operation used for READ_EVENT
+    int armed;        // Bitmask of multishot operations in flight
+    struct msghdr msg; // Template for multishot recvmsg()
+  };
+
+  struct io_uring_sqe* get_sqe();
+  void arm(Socket h, int op);
+  void cancel(Socket h, int op);
+  void dispatch(struct io_uring_cqe* cqe);
+  void recycle_buffer(unsigned short bid);
+  int submit_and_wait(TimeValue* timeout);
+
+  static unsigned long long make_user_data(Socket h, int op, unsigned int gen);
+
+private:
+  int ringfd_;
+  unsigned int pending_; // SQEs queued but not yet submitted
+
+  // Submission queue
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  unsigned int* sq_head_;
+  unsigned int* sq_tail_;
+  unsigned int* sq_array_;
+  unsigned int sq_mask_;
+  unsigned int sq_entries_;
+  struct io_uring_sqe* sqes_;
+
+  // Completion queue
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  unsigned int* cq_head_;
+  unsigned int* cq_tail_;
+  unsigned int cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // Provided buffer ring
+  struct io_uring_buf_ring* buf_ring_;
+  char* bufs_;
+
+  // Slots never move, so the kernel can keep pointing at their msghdr
+  HandleTable<Slot> slots_;
+};
+
+#endif // HAS_IO_URING
+
 /**
  * @brief Use kqueue() (for BSD systems) as demultiplexer.
  */
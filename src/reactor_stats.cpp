@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <mutex>
+
+#include "reactor_stats.h"
+
+namespace {
+
+std::mutex segment_mutex;
+StatsSegment* segment = nullptr;
+bool segment_failed = false;
+char segment_path[64];
+
+void remove_segment() {
+  unlink(segment_path);
+}
+
+/**
+ * @brief Map the segment of this process, creating the file the first
+ * time. A file left by a process which had the same ID is overwritten.
+ */
+StatsSegment* open_segment() {
+  if (segment != nullptr || segment_failed)
+    return segment;
+
+  segment_failed = true;
+  StatsExport::path(getpid(), segment_path, sizeof(segment_path));
+  int fd = open(segment_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror("open stats segment");
+    return nullptr;
+  }
+  if (ftruncate(fd, sizeof(StatsSegment)) < 0) {
+    perror("ftruncate stats segment");
+    close(fd);
+    unlink(segment_path);
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror("mmap stats segment");
+    unlink(segment_path);
+    return nullptr;
+  }
+
+  // The file is zero-filled, readers check the magic number last
+  segment = (StatsSegment*) addr;
+  segment->version = STATS_VERSION;
+  segment->nslots = STATS_MAX_REACTORS;
+  segment->pid = getpid();
+  std::atomic_thread_fence(std::memory_order_release);
+  segment->magic = STATS_MAGIC;
+  segment_failed = false;
+  atexit(remove_segment);
+  return segment;
+}
+
+}
+
+void StatsExport::path(int pid, char* buf, size_t len) {
+  snprintf(buf, len, STATS_SEGMENT_PREFIX "%d", pid);
+}
+
+StatsSlot* StatsExport::acquire() {
+  std::lock_guard<std::mutex> lock(segment_mutex);
+  StatsSegment* seg = open_segment();
+  if (seg == nullptr)
+    return nullptr;
+
+  for (unsigned int i = 0; i < STATS_MAX_REACTORS; i++) {
+    StatsSlot* slot = &seg->slots[i];
+    if (slot->used)
+      continue;
+
+    unsigned int seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->used = 1;
+    slot->tid = (int) syscall(SYS_gettid);
+    slot->updated = 0;
+    memset(&slot->stats, 0x00, sizeof(slot->stats));
+    slot->seq.store(seq + 2, std::memory_order_release);
+    return slot;
+  }
+  return nullptr;
+}
+
+void StatsExport::release(StatsSlot* slot) {
+  std::lock_guard<std::mutex> lock(segment_mutex);
+  unsigned int seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->used = 0;
+  slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+void StatsExport::publish(StatsSlot* slot, const ReactorStats& stats, unsigned long long now) {
+  // Only the owner writes, so the sequence needs no read-modify-write
+  unsigned int seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->tid = (int) syscall(SYS_gettid);
+  slot->updated = now;
+  memcpy(&slot->stats, &stats, sizeof(stats));
+  slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool StatsExport::read(const StatsSlot* slot, StatsSlot* copy) {
+  // A writer killed halfway leaves the sequence odd for ever
+  for (int attempt = 0; attempt < 1000; attempt++) {
+    unsigned int seq = slot->seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    copy->used = slot->used;
+    copy->tid = slot->tid;
+    copy->updated = slot->updated;
+    memcpy(&copy->stats, &slot->stats, sizeof(copy->stats));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->seq.load(std::memory_order_relaxed) == seq) {
+      copy->seq.store(seq, std::memory_order_relaxed);
+      return copy->used != 0;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,130 @@
+/**
+ *  Counters of a Reactor and their export to other processes.
+ *
+ *  Every Reactor has a ReactorStats written by its own thread only, so the
+ *  counters are plain integers incremented without atomics. With
+ *  ReactorConfig::export_stats, the Reactor copies them every
+ *  STATS_PUBLISH_MS into its slot of a StatsSegment, a file under /dev/shm
+ *  named after the process ID and mapped shared by all the Reactors of the
+ *  process. Tools such as tools/reactor-top map the same file read-only,
+ *  so the process is never stopped, signaled nor traced to be observed.
+ *
+ *  A slot is a seqlock: its sequence number is odd while the owner writes
+ *  the copy, a reader copies it and retries if the number was odd or
+ *  changed meanwhile.
+ */
+#ifndef REACTOR_STATS_H_
+#define REACTOR_STATS_H_
+
+#include <atomic>
+#include <stddef.h>
+
+#include "common.h"
+
+#define STATS_SEGMENT_PREFIX "/dev/shm/libreactor." //followed by the process ID
+
+const unsigned int STATS_MAGIC = 0x52535431; //"RST1", first word of a StatsSegment
+const unsigned int STATS_VERSION = 1;        //bumped on any change of the layout
+
+/**
+ * @struct ReactorStats
+ *
+ * @brief Totals since the Reactor was created. handlers is a level.
+ */
+struct ReactorStats {
+  unsigned long long iterations;  //handle_events() calls
+  unsigned long long wakeups;     //waits which returned events
+  unsigned long long events;      //events (or completions) returned by the waits
+  unsigned long long batch[STATS_BATCH_BUCKETS]; //waits by events returned: 0, 1, 2-3, 4-7...
+
+  //system calls by type
+  unsigned long long sys_wait;    //select, poll, epoll_wait, io_uring_enter...
+  unsigned long long sys_read;    //recvmsg, recvmmsg, splice from a socket
+  unsigned long long sys_write;   //sendmsg, sendmmsg, sendfile, splice to a socket
+  unsigned long long sys_accept;  //accept4, including the one seeing EAGAIN
+  unsigned long long sys_ctl;     //epoll_ctl, kevent changes, io_uring submissions alone
+
+  unsigned long long accepts;     //connections accepted, shed ones included
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long long messages_in;  //SIP messages framed and datagrams received
+  unsigned long long messages_out; //sends queued on connections and datagrams sent
+  unsigned long long drops;        //connections shed, datagrams, sends and worker messages refused
+  unsigned long long truncations;  //datagrams larger than the receive buffer
+
+  long long handlers;             //handlers registered with the demultiplexer
+};
+
+/**
+ * @brief Bucket of ReactorStats::batch for a wait returning @a n events.
+ */
+inline unsigned int stats_bucket(unsigned int n) {
+  unsigned int bucket = (n == 0) ? 0 : 32 - __builtin_clz(n);
+  return (bucket < STATS_BATCH_BUCKETS) ? bucket : STATS_BATCH_BUCKETS - 1;
+}
+
+/**
+ * @struct StatsSlot
+ *
+ * @brief Copy of the counters of one Reactor.
+ */
+struct StatsSlot {
+  std::atomic<unsigned int> seq; //odd while the owner writes
+  unsigned int used;             //1 while a Reactor owns the slot
+  int tid;                       //thread running the Reactor's loop
+  unsigned long long updated;    //CLOCK_MONOTONIC milliseconds of the copy
+  ReactorStats stats;
+  char pad_[64];                 //slots of different threads do not share cache lines
+};
+
+/**
+ * @struct StatsSegment
+ *
+ * @brief Layout of the shared file of a process.
+ */
+struct StatsSegment {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int nslots;
+  int pid;
+  char pad_[64];
+  StatsSlot slots[STATS_MAX_REACTORS];
+};
+
+/**
+ * @class StatsExport
+ *
+ * @brief Slots of the segment of this process, created on first use and
+ * removed at exit.
+ */
+class StatsExport {
+public:
+  /**
+   * @brief Take a free slot for a Reactor, nullptr if the segment cannot
+   * be created or all STATS_MAX_REACTORS slots are taken.
+   */
+  static StatsSlot* acquire();
+
+  /**
+   * @brief Give back the slot of a Reactor being destroyed.
+   */
+  static void release(StatsSlot* slot);
+
+  /**
+   * @brief Copy @a stats into @a slot, called by the owner of the slot.
+   */
+  static void publish(StatsSlot* slot, const ReactorStats& stats, unsigned long long now);
+
+  /**
+   * @brief Consistent copy of a slot written by another thread or process.
+   * Return false if the slot is not in use.
+   */
+  static bool read(const StatsSlot* slot, StatsSlot* copy);
+
+  /**
+   * @brief Path of the segment of process @a pid.
+   */
+  static void path(int pid, char* buf, size_t len);
+};
+
+#endif // REACTOR_STATS_H_
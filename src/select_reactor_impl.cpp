@@ -20,6 +20,8 @@ void SelectReactorImpl::handle_events(TimeValue* timeout) {
   exceptset = exset_;
 
   int result = select(max_handle_+1, &readset, &writeset, &exceptset, timeout);
+  update_time();
+  count_wait(result);
   if (result < 0) {
     //exit(EXIT_FAILURE);
     perror("select() error");
@@ -27,6 +29,15 @@ void SelectReactorImpl::handle_events(TimeValue* timeout) {
   }
 
   for (Socket h = 0; h <= max_handle_; h++) {
+    //A handler may have removed another one of this round
+    if (table_.table_[h].event_handler == nullptr) {
+      if (FD_ISSET(h, &readset) || FD_ISSET(h, &writeset) || FD_ISSET(h, &exceptset)) {
+        if (--result <= 0)
+          break;
+      }
+      continue;
+    }
+
     //We should check for incoming events in each SOCKET
     if (FD_ISSET(h, &readset)) {
       (table_.table_[h].event_handler)->handle_event(h, READ_EVENT);
@@ -90,6 +101,8 @@ void SelectReactorImpl::mHandleEvents(Time_Value* timeout){
 void SelectReactorImpl::register_handler(EventHandler* eh, EventType et) {
   // Get SOCKET associated with this EventHandler object
   Socket temp = eh->get_handle();
+  if (table_.table_[temp].event_handler == nullptr)
+    stats_->handlers++;
   table_.table_[temp].event_handler = eh;
   table_.table_[temp].event_type = et;
   
@@ -116,6 +129,8 @@ void SelectReactorImpl::register_handler(Socket h, EventHandler* eh, EventType e
  */
 void SelectReactorImpl::remove_handler(EventHandler* eh, EventType et) {
   Socket temp = eh->get_handle();
+  if (table_.table_[temp].event_handler != nullptr)
+    stats_->handlers--;
   table_.table_[temp].event_handler = nullptr;
   table_.table_[temp].event_type = 0;
 
@@ -129,6 +144,8 @@ void SelectReactorImpl::remove_handler(EventHandler* eh, EventType et) {
 }
 
 void SelectReactorImpl::remove_handler(Socket h, EventType et) {
+  if (table_.table_[h].event_handler != nullptr)
+    stats_->handlers--;
   table_.table_[h].event_handler = nullptr;
   table_.table_[h].event_type = 0;
 
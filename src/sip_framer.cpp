@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sip_framer.h"
+#include "sip_scan.h"
+
+SipFramer::SipFramer(BufferPool* pool, size_t max_size) {
+  pool_ = pool;
+  max_capacity_ = BufferPool::class_size(max_size);
+  // No buffer until data is about to be received
+  buf_ = nullptr;
+  capacity_ = mask_ = 0;
+  head_ = tail_ = scan_ = line_ = end_ = 0;
+  state_ = START;
+  content_length_ = -1;
+  crlf_run_ = 0;
+  delivered_ = false;
+}
+
+SipFramer::~SipFramer() {
+  release();
+}
+
+void SipFramer::release() {
+  if (buf_ == nullptr)
+    return;
+  if (pool_ != nullptr)
+    pool_->put(buf_, capacity_);
+  else
+    free(buf_);
+  buf_ = nullptr;
+  capacity_ = mask_ = 0;
+}
+
+/**
+ * @brief Move the buffered data to the start of a new buffer of the
+ * smallest class holding @a size bytes, and release the current one.
+ * Return false if there is no such class or it cannot be allocated.
+ */
+bool SipFramer::relocate(size_t size) {
+  if (size < tail_ - head_)
+    size = tail_ - head_;
+  size_t capacity = BufferPool::class_size(size);
+  if (capacity == 0 || capacity > max_capacity_)
+    return false;
+
+  char* buf = (pool_ != nullptr) ? pool_->get(capacity) : (char*) malloc(capacity);
+  if (buf == nullptr)
+    return false;
+
+  size_t used = tail_ - head_;
+  if (used > 0) {
+    size_t start = head_ & mask_;
+    size_t first = (start + used <= capacity_) ? used : capacity_ - start;
+    memcpy(buf, buf_ + start, first);
+    memcpy(buf + first, buf_, used - first);
+  }
+  release();
+  buf_ = buf;
+  capacity_ = capacity;
+  mask_ = capacity - 1;
+
+  // Positions behind the start of the data are stale
+  scan_ = (scan_ > head_) ? scan_ - head_ : 0;
+  line_ = (line_ > head_) ? line_ - head_ : 0;
+  end_ = (end_ > head_) ? end_ - head_ : 0;
+  tail_ = used;
+  head_ = 0;
+  return true;
+}
+
+int SipFramer::get_free(struct iovec iov[2]) {
+  // Grow to hold the whole body, or by a class when full
+  size_t want = tail_ - head_ + 1;
+  if (state_ == BODY && end_ - head_ > want)
+    want = end_ - head_;
+  if (want > capacity_)
+    relocate(want);
+
+  size_t room = capacity_ - (tail_ - head_);
+  if (room == 0)
+    return 0;
+
+  size_t start = tail_ & mask_;
+  size_t first = capacity_ - start;
+  if (first >= room) {
+    iov[0].iov_base = buf_ + start;
+    iov[0].iov_len = room;
+    return 1;
+  }
+
+  iov[0].iov_base = buf_ + start;
+  iov[0].iov_len = first;
+  iov[1].iov_base = buf_;
+  iov[1].iov_len = room - first;
+  return 2;
+}
+
+void SipFramer::commit(size_t len) {
+  tail_ += len;
+}
+
+size_t SipFramer::append(const char* data, size_t len) {
+  struct iovec iov[2];
+  int count = get_free(iov);
+  size_t copied = 0;
+
+  for (int i = 0; i < count && copied < len; i++) {
+    size_t n = len - copied;
+    if (n > iov[i].iov_len)
+      n = iov[i].iov_len;
+    memcpy(iov[i].iov_base, data + copied, n);
+    copied += n;
+  }
+
+  commit(copied);
+  return copied;
+}
+
+/**
+ * @brief Find the first LF at or after @a from in the received data.
+ */
+bool SipFramer::find_lf(size_t from, size_t* lf) const {
+  while (from < tail_) {
+    size_t start = from & mask_;
+    size_t n = tail_ - from;
+    if (n > capacity_ - start)
+      n = capacity_ - start;
+
+    const char* found = sip_find_char(buf_ + start, buf_ + start + n, '\n');
+    if (found != nullptr) {
+      *lf = from + (found - (buf_ + start));
+      return true;
+    }
+    from += n;
+  }
+  return false;
+}
+
+/**
+ * @brief Skip spaces, tabs and the CRLFs of folded lines from @a pos.
+ */
+size_t SipFramer::skip_lws(size_t pos, size_t end) const {
+  while (pos < end) {
+    char c = at(pos);
+    if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+      break;
+    pos++;
+  }
+  return pos;
+}
+
+/**
+ * @brief Pick up Content-Length, or its compact form "l", from the header
+ * [begin, end), folded lines included. It is parsed in place, even when
+ * it wraps around the end of the ring. Return false if its value is not
+ * a number.
+ */
+bool SipFramer::parse_header(size_t begin, size_t end) {
+  static const char name[] = "content-length";
+  const size_t name_len = sizeof(name) - 1;
+
+  // Setting bit 5 lowers letters and leaves '-' alone
+  size_t pos = begin;
+  size_t matched = 0;
+  while (matched < name_len && pos + matched < end &&
+         (at(pos + matched) | 0x20) == name[matched])
+    matched++;
+  if (matched == name_len)
+    pos += name_len;
+  else if (pos < end && (at(pos) | 0x20) == 'l')
+    pos += 1;
+  else
+    return true;
+
+  pos = skip_lws(pos, end);
+  if (pos >= end || at(pos) != ':')
+    return true; // Another header starting with the same letters
+  pos = skip_lws(pos + 1, end);
+
+  unsigned long number = 0;
+  size_t digits = 0;
+  while (pos < end && digits < 19 && at(pos) >= '0' && at(pos) <= '9') {
+    number = number * 10 + (at(pos) - '0');
+    pos++;
+    digits++;
+  }
+  if (digits == 0)
+    return false;
+  long value = (long) number;
+
+  // Anything above the capacity is rejected once the headers are complete
+  content_length_ = (value > (long) max_capacity_) ? max_capacity_ + 1 : value;
+  return true;
+}
+
+/**
+ * @brief Give the buffer back when it is empty, an idle connection holds
+ * none. The next message starts at the beginning of a fresh one.
+ */
+void SipFramer::reset_if_empty() {
+  if (head_ == tail_) {
+    head_ = tail_ = scan_ = line_ = end_ = 0;
+    release();
+  }
+}
+
+SipFramer::Result SipFramer::next(char** msg, size_t* len) {
+  if (delivered_) {
+    head_ = scan_ = line_ = end_;
+    delivered_ = false;
+    state_ = START;
+  }
+
+  for (;;) {
+    switch (state_) {
+    case START:
+      while (scan_ < tail_) {
+        char c = at(scan_);
+        if (c != '\r' && c != '\n')
+          break;
+        scan_++;
+        if (++crlf_run_ == 4) {
+          crlf_run_ = 0;
+          head_ = scan_;
+          reset_if_empty();
+          return PING;
+        }
+      }
+
+      head_ = scan_;
+      if (scan_ == tail_) {
+        reset_if_empty();
+        return NEED_MORE;
+      }
+
+      crlf_run_ = 0;
+      line_ = scan_;
+      content_length_ = -1;
+      state_ = HEADERS;
+      break;
+
+    case HEADERS: {
+      size_t lf;
+      if (!find_lf(scan_, &lf)) {
+        scan_ = tail_;
+        return (tail_ - head_ >= max_capacity_) ? ERROR : NEED_MORE;
+      }
+
+      size_t length = lf - line_;
+      bool empty = length == 0 || (length == 1 && at(line_) == '\r');
+
+      // A line starting with a space or a tab continues the header, which
+      // is only parsed once the next line tells where it ends
+      if (!empty) {
+        if (lf + 1 == tail_) {
+          scan_ = lf;
+          return (tail_ - head_ >= max_capacity_) ? ERROR : NEED_MORE;
+        }
+        char next = at(lf + 1);
+        if (next == ' ' || next == '\t') {
+          scan_ = lf + 1;
+          break;
+        }
+      }
+
+      scan_ = lf + 1;
+      if (empty) {
+        // Empty line, the body follows
+        if (content_length_ < 0)
+          return ERROR;
+        end_ = scan_ + content_length_;
+        if (end_ - head_ > max_capacity_)
+          return ERROR;
+        state_ = BODY;
+      } else if (!parse_header(line_, lf)) {
+        return ERROR;
+      }
+      line_ = scan_;
+      break;
+    }
+
+    case BODY: {
+      if (tail_ < end_)
+        return NEED_MORE;
+
+      // A message wrapping around the end of the ring is moved to the
+      // start of a buffer of its own
+      size_t length = end_ - head_;
+      if ((head_ & mask_) + length > capacity_ && !relocate(length))
+        return ERROR;
+
+      *msg = buf_ + (head_ & mask_);
+      *len = length;
+      delivered_ = true;
+      return MESSAGE;
+    }
+    }
+  }
+}
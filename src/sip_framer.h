@@ -0,0 +1,103 @@
+#ifndef SIP_FRAMER_H_
+#define SIP_FRAMER_H_
+
+#include <sys/uio.h>
+
+#include "common.h"
+#include "buffer_pool.h"
+
+/**
+ * @class SipFramer
+ *
+ * @brief Split a SIP byte stream into messages. Data is received straight
+ * into a ring buffer (see get_free()), then headers are scanned line by
+ * line as bytes arrive, without going over the same bytes twice, and the
+ * body is delimited by Content-Length parsed in place. A message is handed
+ * out as a pointer into the ring, it is only copied when it wraps around
+ * the end of the ring. RFC 5626 CRLF keepalives between messages are
+ * reported separately.
+ *
+ * The ring is a buffer of a BufferPool, taken when data is about to be
+ * received and given back as soon as no partial message is left in it.
+ * It starts at the smallest class and moves to a larger one when full or
+ * when the body of the current message does not fit.
+ */
+class SipFramer {
+public:
+  enum Result {
+    NEED_MORE = 0, // No complete message buffered
+    MESSAGE,       // A message is returned
+    PING,          // A double CRLF keepalive was received
+    ERROR          // Message too large or without Content-Length
+  };
+
+  /**
+   * @brief Buffers come from @a pool, or from malloc() without one.
+   * Messages above @a max_size bytes are refused.
+   */
+  SipFramer(BufferPool* pool=nullptr, size_t max_size=SIP_MSG_MAX_SIZE);
+  ~SipFramer();
+
+  /**
+   * @brief Describe the free space of the ring for readv(), taking or
+   * growing the buffer as needed. Return the number of iovecs filled, 0 if
+   * the ring is full at its largest size or no buffer is available.
+   */
+  int get_free(struct iovec iov[2]);
+
+  /**
+   * @brief Account for @a len bytes written into the free space.
+   */
+  void commit(size_t len);
+
+  /**
+   * @brief Copy as much of @a data as fits. Return the number of bytes copied.
+   */
+  size_t append(const char* data, size_t len);
+
+  /**
+   * @brief Get the next message. It stays valid until the next call.
+   */
+  Result next(char** msg, size_t* len);
+
+private:
+  enum State {
+    START,    // Between messages, skipping CRLFs
+    HEADERS,  // Looking for the end of the current header
+    BODY      // Waiting for Content-Length bytes of body
+  };
+
+  char at(size_t pos) const {
+    return buf_[pos & mask_];
+  }
+
+  bool find_lf(size_t from, size_t* lf) const;
+  size_t skip_lws(size_t pos, size_t end) const;
+  bool parse_header(size_t begin, size_t end);
+  void reset_if_empty();
+  bool relocate(size_t size);
+  void release();
+
+private:
+  BufferPool* pool_;
+  size_t max_capacity_;
+
+  // nullptr with a capacity of 0 while no data is buffered
+  char* buf_;
+  size_t capacity_;
+  size_t mask_;
+
+  // Positions only grow, they are reduced modulo capacity_ on access
+  size_t head_;  // Start of the current message
+  size_t tail_;  // End of received data
+  size_t scan_;  // Next byte to be scanned
+  size_t line_;  // Start of the current header, folded lines included
+  size_t end_;   // End of the current message, once headers are complete
+
+  State state_;
+  long content_length_;   // -1 until the header is found
+  unsigned int crlf_run_; // CR and LF bytes seen between messages
+  bool delivered_;        // The message at head_ was returned
+};
+
+#endif // SIP_FRAMER_H_
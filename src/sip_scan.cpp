@@ -0,0 +1,399 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "sip_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef const char* (*FindCharFn) (const char* begin, const char* end, char c);
+typedef const char* (*FindHeaderEndFn) (const char* begin, const char* end);
+typedef const char* (*FindLineFn) (const char* begin, const char* end, char a, char b);
+
+static const uint64_t ONES = 0x0101010101010101ULL;
+static const uint64_t HIGHS = 0x8080808080808080ULL;
+
+static inline uint64_t load_word(const char* p, size_t len) {
+  uint64_t word = 0;
+  memcpy(&word, p, (len < 8) ? len : 8);
+  return word;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Scalar kernels
+///////////////////////////////////////////////////////////////////////////
+
+static const char* find_char_bytes(const char* begin, const char* end, char c) {
+  for (; begin < end; begin++) {
+    if (*begin == c)
+      return begin;
+  }
+  return nullptr;
+}
+
+static const char* find_char_scalar(const char* begin, const char* end, char c) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // A byte of word ^ pattern is zero where c is, spot it 8 bytes at a time
+  const uint64_t pattern = (unsigned char) c * ONES;
+  for (; begin + 8 <= end; begin += 8) {
+    uint64_t word = load_word(begin, 8) ^ pattern;
+    uint64_t zero = (word - ONES) & ~word & HIGHS;
+    if (zero != 0)
+      return begin + __builtin_ctzll(zero) / 8;
+  }
+#endif
+  return find_char_bytes(begin, end, c);
+}
+
+static const char* find_header_end_scalar(const char* begin, const char* end) {
+  // Look for the last LF of the pattern, then check the 3 bytes before
+  for (const char* p = begin + 3; p < end; p++) {
+    p = find_char_scalar(p, end, '\n');
+    if (p == nullptr)
+      return nullptr;
+    if (p[-3] == '\r' && p[-2] == '\n' && p[-1] == '\r')
+      return p - 3;
+  }
+  return nullptr;
+}
+
+static const char* find_line_scalar(const char* begin, const char* end, char a, char b) {
+  for (const char* p = begin; p + 1 < end; p++) {
+    p = find_char_scalar(p, end - 1, '\n');
+    if (p == nullptr)
+      return nullptr;
+    char next = p[1] | 0x20;
+    if (next == a || next == b)
+      return p + 1;
+  }
+  return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// SSE2 kernels, SSE2 is always there on x86-64. Input is taken 64 bytes
+// at a time and turned into a bitmask per character class, so that
+// multi-byte patterns are matched by shifting masks instead of reloading.
+///////////////////////////////////////////////////////////////////////////
+
+#if defined (HAS_X86_SIMD)
+
+__attribute__((target("sse2")))
+static inline uint64_t eq_mask_sse2(const char* p, __m128i needle) {
+  uint64_t m0 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), needle));
+  uint64_t m1 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 16)), needle));
+  uint64_t m2 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 32)), needle));
+  uint64_t m3 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + 48)), needle));
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+__attribute__((target("sse2")))
+static inline uint64_t letter_mask_sse2(const char* p, __m128i a, __m128i b) {
+  const __m128i lower = _mm_set1_epi8(0x20);
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i chunk = _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + 16 * i)), lower);
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(chunk, a), _mm_cmpeq_epi8(chunk, b));
+    mask |= (uint64_t)(unsigned int) _mm_movemask_epi8(eq) << (16 * i);
+  }
+  return mask;
+}
+
+__attribute__((target("sse2")))
+static const char* find_char_sse2(const char* begin, const char* end, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  const char* p = begin;
+
+  for (; p + 64 <= end; p += 64) {
+    uint64_t mask = eq_mask_sse2(p, needle);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask);
+  }
+  return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("sse2")))
+static const char* find_header_end_sse2(const char* begin, const char* end) {
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const char* p = begin;
+
+  // Only the first 61 positions of a block can hold the whole pattern
+  for (; p + 64 <= end; p += 61) {
+    uint64_t crs = eq_mask_sse2(p, cr);
+    uint64_t lfs = eq_mask_sse2(p, lf);
+    uint64_t mask = crs & (lfs >> 1) & (crs >> 2) & (lfs >> 3);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask);
+  }
+  return find_header_end_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* find_line_sse2(const char* begin, const char* end, char a, char b) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i first = _mm_set1_epi8(a);
+  const __m128i second = _mm_set1_epi8(b);
+  const char* p = begin;
+
+  // A LF followed by one of the two letters, in either case
+  for (; p + 64 <= end; p += 63) {
+    uint64_t mask = eq_mask_sse2(p, lf) & (letter_mask_sse2(p, first, second) >> 1);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask) + 1;
+  }
+  return find_line_scalar(p, end, a, b);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// AVX2 kernels, only called after checking the CPU supports them
+///////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask_avx2(const char* p, __m256i needle) {
+  uint64_t m0 = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p), needle));
+  uint64_t m1 = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + 32)), needle));
+  return m0 | (m1 << 32);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t letter_mask_avx2(const char* p, __m256i a, __m256i b) {
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  __m256i c0 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) p), lower);
+  __m256i c1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (p + 32)), lower);
+  uint64_t m0 = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c0, a), _mm256_cmpeq_epi8(c0, b)));
+  uint64_t m1 = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c1, a), _mm256_cmpeq_epi8(c1, b)));
+  return m0 | (m1 << 32);
+}
+
+__attribute__((target("avx2")))
+static const char* find_char_avx2(const char* begin, const char* end, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  const char* p = begin;
+
+  for (; p + 64 <= end; p += 64) {
+    uint64_t mask = eq_mask_avx2(p, needle);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask);
+  }
+  return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char* find_header_end_avx2(const char* begin, const char* end) {
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const char* p = begin;
+
+  for (; p + 64 <= end; p += 61) {
+    uint64_t crs = eq_mask_avx2(p, cr);
+    uint64_t lfs = eq_mask_avx2(p, lf);
+    uint64_t mask = crs & (lfs >> 1) & (crs >> 2) & (lfs >> 3);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask);
+  }
+  return find_header_end_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_line_avx2(const char* begin, const char* end, char a, char b) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i first = _mm256_set1_epi8(a);
+  const __m256i second = _mm256_set1_epi8(b);
+  const char* p = begin;
+
+  for (; p + 64 <= end; p += 63) {
+    uint64_t mask = eq_mask_avx2(p, lf) & (letter_mask_avx2(p, first, second) >> 1);
+    if (mask != 0)
+      return p + __builtin_ctzll(mask) + 1;
+  }
+  return find_line_scalar(p, end, a, b);
+}
+
+#endif // HAS_X86_SIMD
+
+///////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+///////////////////////////////////////////////////////////////////////////
+
+struct ScanImpl {
+  const char* name;
+  FindCharFn find_char;
+  FindHeaderEndFn find_header_end;
+  FindLineFn find_line;
+};
+
+static const ScanImpl impls[] = {
+  { "scalar", find_char_scalar, find_header_end_scalar, find_line_scalar },
+#if defined (HAS_X86_SIMD)
+  { "sse2", find_char_sse2, find_header_end_sse2, find_line_sse2 },
+  { "avx2", find_char_avx2, find_header_end_avx2, find_line_avx2 },
+#endif // HAS_X86_SIMD
+};
+
+static bool is_supported(const ScanImpl& impl) {
+#if defined (HAS_X86_SIMD)
+  if (strcmp(impl.name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  if (strcmp(impl.name, "sse2") == 0)
+    return __builtin_cpu_supports("sse2");
+#endif // HAS_X86_SIMD
+  return true;
+}
+
+static const ScanImpl* resolve() {
+  const ScanImpl* best = &impls[0];
+  for (size_t i = 1; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if (is_supported(impls[i]))
+      best = &impls[i];
+  }
+  return best;
+}
+
+static const ScanImpl* current = resolve();
+
+bool sip_scan_select(const char* name) {
+  for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if (strcmp(impls[i].name, name) == 0 && is_supported(impls[i])) {
+      current = &impls[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* sip_scan_impl() {
+  return current->name;
+}
+
+const char* sip_find_char(const char* begin, const char* end, char c) {
+  return current->find_char(begin, end, c);
+}
+
+const char* sip_find_header_end(const char* begin, const char* end) {
+  return current->find_header_end(begin, end);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// SWAR helpers, 8 bytes at a time in a 64-bit word
+///////////////////////////////////////////////////////////////////////////
+
+bool sip_match_name(const char* p, size_t len, const char* name, size_t name_len) {
+  if (len < name_len)
+    return false;
+
+  // Setting bit 5 (a space) lowers letters and leaves digits and '-'
+  static const char spaces[] = "        ";
+  size_t i = 0;
+  for (; i + 8 <= name_len; i += 8) {
+    if ((load_word(p + i, 8) | load_word(spaces, 8)) != load_word(name + i, 8))
+      return false;
+  }
+  if (i < name_len) {
+    size_t rest = name_len - i;
+    if ((load_word(p + i, rest) | load_word(spaces, rest)) != load_word(name + i, rest))
+      return false;
+  }
+  return true;
+}
+
+size_t sip_parse_uint(const char* p, size_t len, unsigned long* value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  unsigned long result = 0;
+  size_t digits = 0;
+
+  // At most 19 digits fit in 64 bits
+  while (digits < len && digits < 19) {
+    size_t avail = len - digits;
+    uint64_t word = load_word(p + digits, avail);
+
+    // A byte is a digit if its high nibble is 3 and its low nibble below 10
+    uint64_t bad = ((word & (0xF0 * ONES)) ^ (0x30 * ONES)) |
+      (((word & (0x0F * ONES)) + (0x06 * ONES)) & (0xF0 * ONES));
+    if (avail < 8)
+      bad |= ~0ULL << (8 * avail);
+
+    size_t count = (bad == 0) ? 8 : __builtin_ctzll(bad) / 8;
+    if (digits + count > 19)
+      count = 19 - digits;
+    if (count == 0)
+      break;
+
+    // Keep the digits, moved to the top so that they read as a
+    // zero-padded 8-digit number, then combine pairs, quads and octets
+    word = (word & (0x0F * ONES)) << (8 * (8 - count));
+    word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+    word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+    word = (word * 10000 + (word >> 32)) & 0x00000000FFFFFFFFULL;
+
+    static const unsigned long powers[] = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+    };
+    result = result * powers[count] + word;
+    digits += count;
+    if (count < 8)
+      break;
+  }
+
+  if (digits > 0)
+    *value = result;
+  return digits;
+#else
+  unsigned long result = 0;
+  size_t digits = 0;
+  while (digits < len && digits < 19 && p[digits] >= '0' && p[digits] <= '9') {
+    result = result * 10 + (p[digits] - '0');
+    digits++;
+  }
+  if (digits > 0)
+    *value = result;
+  return digits;
+#endif
+}
+
+bool sip_header_content_length(const char* line, const char* eol, long* value) {
+  static const char name[] = "content-length";
+  const size_t name_len = sizeof(name) - 1;
+
+  const char* p = line;
+  if (sip_match_name(p, eol - p, name, name_len))
+    p += name_len;
+  else if (p < eol && (*p | 0x20) == 'l')
+    p += 1;
+  else
+    return false;
+
+  while (p < eol && (*p == ' ' || *p == '\t'))
+    p++;
+  if (p >= eol || *p != ':')
+    return false; // Another header starting with the same letters
+
+  p++;
+  while (p < eol && (*p == ' ' || *p == '\t'))
+    p++;
+
+  unsigned long number;
+  if (sip_parse_uint(p, eol - p, &number) == 0)
+    *value = -1;
+  else
+    *value = (long) number;
+  return true;
+}
+
+long sip_content_length(const char* begin, const char* end) {
+  // Only visit the lines starting like "Content-Length" or "l", the
+  // first one is the request or status line
+  const char* line = begin;
+  while ((line = current->find_line(line, end, 'c', 'l')) != nullptr) {
+    const char* eol = sip_find_char(line, end, '\n');
+    if (eol == nullptr)
+      eol = end;
+
+    long value;
+    if (sip_header_content_length(line, eol, &value))
+      return value;
+    line = eol;
+  }
+  return -1;
+}
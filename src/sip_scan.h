@@ -0,0 +1,56 @@
+/**
+ *  Scanning kernels for the hot spots of SIP parsing: delimiters, header
+ *  names and Content-Length. On x86 the SSE2 or AVX2 version is picked at
+ *  startup from what the CPU supports, other targets use the scalar code.
+ */
+#ifndef SIP_SCAN_H_
+#define SIP_SCAN_H_
+
+#include <stddef.h>
+
+/**
+ * @brief First occurrence of @a c in [begin, end), nullptr if none.
+ */
+const char* sip_find_char(const char* begin, const char* end, char c);
+
+/**
+ * @brief First "\r\n\r\n" in [begin, end), nullptr if none.
+ */
+const char* sip_find_header_end(const char* begin, const char* end);
+
+/**
+ * @brief Whether @a p starts with @a name, ignoring case. @a name is lower
+ * case and made of letters, digits and '-'. @a p holds at least @a len bytes.
+ */
+bool sip_match_name(const char* p, size_t len, const char* name, size_t name_len);
+
+/**
+ * @brief Parse the decimal number at the beginning of [p, p+len), 8 digits
+ * at a time. Return the number of digits, 0 if there is none.
+ */
+size_t sip_parse_uint(const char* p, size_t len, unsigned long* value);
+
+/**
+ * @brief Whether the header line [line, eol) is Content-Length or its
+ * compact form "l". If so, @a value is set to its value, -1 if invalid.
+ */
+bool sip_header_content_length(const char* line, const char* eol, long* value);
+
+/**
+ * @brief Value of Content-Length, or of its compact form "l", in the
+ * header lines [begin, end), -1 if it is absent or invalid.
+ */
+long sip_content_length(const char* begin, const char* end);
+
+/**
+ * @brief Force an implementation: "scalar", "sse2" or "avx2". Return false
+ * if it is not available on this CPU. Meant for benchmarks.
+ */
+bool sip_scan_select(const char* name);
+
+/**
+ * @brief Name of the implementation in use.
+ */
+const char* sip_scan_impl();
+
+#endif // SIP_SCAN_H_
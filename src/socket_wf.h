@@ -16,12 +16,39 @@
 #define SOCKET_WF_H_
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 
+#if defined (HAS_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif // HAS_ZEROCOPY
+
+#if defined (HAS_SENDFILE)
+#include <sys/sendfile.h>
+#endif // HAS_SENDFILE
+
 #include "common.h"
+#include "object_pool.h"
+
+
+//Allow several sockets to bind to the same address and port (SO_REUSEPORT)
+inline void set_reuse_port(Socket handle) {
+  int on = 1;
+  if (setsockopt(handle, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    perror("setsockopt SO_REUSEPORT");
+}
+
+//Switch the socket to non-blocking mode (O_NONBLOCK)
+inline void set_nonblocking(Socket handle) {
+  int flags = fcntl(handle, F_GETFL, 0);
+  if (flags < 0 || fcntl(handle, F_SETFL, flags | O_NONBLOCK) < 0)
+    perror("fcntl O_NONBLOCK");
+}
 
 
 /**
@@ -89,6 +116,21 @@ public:
     close(handle_);
   }
 
+  //Allocated from @a pool, e.g. the one of the accepting Reactor, or
+  //from the heap. Both are freed by delete
+  static void* operator new(size_t size, ObjectPool* pool) {
+    return pool_new(pool, size);
+  }
+  static void* operator new(size_t size) {
+    return pool_new(nullptr, size);
+  }
+  static void operator delete(void* p, ObjectPool* pool) {
+    ObjectPool::release(p);
+  }
+  static void operator delete(void* p) {
+    ObjectPool::release(p);
+  }
+
   //Set the Socket handle
   void set_handle(Socket connsock) {
     handle_ = connsock;
@@ -107,12 +149,117 @@ public:
   }
 
   //Normal I/O operations
-  ssize_t recv(void* buf, size_t len, int flags);
-  ssize_t send(const char* buf, size_t len, int flags);
+  ssize_t recv(void* buf, size_t len, int flags) {
+    return ::recv(handle_, buf, len, flags);
+  }
+  //Scatter read into several buffers with one system call
+  ssize_t recvv(const struct iovec* iov, int iovcnt, int flags=0) {
+    if (flags == 0)
+      return ::readv(handle_, iov, iovcnt);
+    struct msghdr msg;
+    memset(&msg, 0x00, sizeof(msg));
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = iovcnt;
+    return ::recvmsg(handle_, &msg, flags);
+  }
+  //A peer which has gone raises EPIPE instead of SIGPIPE
+  ssize_t send(const char* buf, size_t len, int flags) {
+    return ::send(handle_, buf, len, flags | MSG_NOSIGNAL);
+  }
+  //Gather write from several buffers with one system call, unlike
+  //writev() it takes flags such as MSG_MORE
+  ssize_t sendv(const struct iovec* iov, int iovcnt, int flags) {
+    struct msghdr msg;
+    memset(&msg, 0x00, sizeof(msg));
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = iovcnt;
+    return ::sendmsg(handle_, &msg, flags | MSG_NOSIGNAL);
+  }
 
-  //I/O operations for short receives and sends
-  ssize_t recv_n(char* buf, size_t len, int flags);
-  ssize_t send_n(const char* buf, size_t len, int flags);
+#if defined (HAS_SENDFILE)
+  //Write file data from the page cache, @a offset is advanced
+  ssize_t send_file(int fd, off_t* offset, size_t count) {
+    return ::sendfile(handle_, fd, offset, count);
+  }
+#endif // HAS_SENDFILE
+
+#if defined (HAS_SPLICE)
+  //Move received data into a pipe, and from a pipe to the peer, without
+  //copying it to user space. The socket must be non-blocking.
+  ssize_t splice_to(int pipe_in, size_t len) {
+    return ::splice(handle_, nullptr, pipe_in, nullptr, len,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  }
+  ssize_t splice_from(int pipe_out, size_t len) {
+    return ::splice(pipe_out, nullptr, handle_, nullptr, len,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  }
+#endif // HAS_SPLICE
+
+#if defined (HAS_ZEROCOPY)
+  //Allow MSG_ZEROCOPY sends, false if the kernel does not support them
+  bool set_zerocopy() {
+    int on = 1;
+    return setsockopt(handle_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+  }
+
+  //Read a message from the error queue. Return 1 for a MSG_ZEROCOPY
+  //completion of the sends [lo, hi], with copied set if the kernel copied
+  //the data anyway, 0 for another message, -1 if the queue is empty
+  int recv_zerocopy(unsigned int* lo, unsigned int* hi, bool* copied) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr msg;
+    memset(&msg, 0x00, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(handle_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      return -1;
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      struct sock_extended_err* err = (struct sock_extended_err*) CMSG_DATA(cm);
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      *lo = err->ee_info;
+      *hi = err->ee_data;
+      *copied = (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+      return 1;
+    }
+    return 0;
+  }
+#endif // HAS_ZEROCOPY
+
+  //I/O operations for short receives and sends: loop until len bytes
+  //are transferred. Return the bytes transferred if the socket would
+  //block, is closed or fails in between, -1 if nothing was
+  ssize_t recv_n(char* buf, size_t len, int flags) {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = ::recv(handle_, buf + done, len - done, flags);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return (done > 0) ? (ssize_t)done : -1;
+      if (n == 0)
+        break;
+      done += n;
+    }
+    return done;
+  }
+  ssize_t send_n(const char* buf, size_t len, int flags) {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = send(buf + done, len - done, flags);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return (done > 0) ? (ssize_t)done : -1;
+      done += n;
+    }
+    return done;
+  }
 
   //Other methods
 
@@ -132,10 +279,14 @@ private:
  */
 class SockAcceptor {
 public:
-  //Constructor initializes listenning socket
-  SockAcceptor(const InetAddr& addr) {
+  //Constructor initializes listenning socket. With reuse_port, several
+  //acceptors can listen on the same address and the kernel spreads
+  //incoming connections across them
+  SockAcceptor(const InetAddr& addr, bool reuse_port=false) {
     //create server socket, use streaming socket (TCP)
     handle_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (reuse_port)
+      set_reuse_port(handle_);
     //bind between server socket and Internet address
     bind(handle_, addr.get_addr(), addr.get_size());
     //change server socket to listenning mode
@@ -147,15 +298,20 @@ public:
   void open(const InetAddr &sock_addr) {
   }
 
-  //Accept a connection and initialize the SOCK_Stream
-  void accept_sock(SockStream* stream) {
+  //Accept a connection and initialize the SOCK_Stream. Flags are those
+  //of accept4() (SOCK_NONBLOCK, SOCK_CLOEXEC). Return the connected socket,
+  //or INVALID_HANDLE_VALUE with errno set
+  Socket accept_sock(SockStream* stream, int flags=0) {
     struct sockaddr_in cliaddr;
     socklen_t clilen = sizeof(cliaddr);
 
-    Socket conn = accept(handle_, (struct sockaddr*)&cliaddr, &clilen);
+    Socket conn = accept4(handle_, (struct sockaddr*)&cliaddr, &clilen, flags);
+    if (conn < 0)
+      return INVALID_HANDLE_VALUE;
     //stream->mSetHandle(conn);
     stream->set_peer(conn, &cliaddr, clilen);
     //      pantheios::log_INFORMATIONAL("Set SOCK_Stream with Connection FD: ", pantheios::integer(conn));
+    return conn;
   }
 
   Socket get_handle() const {
@@ -180,10 +336,24 @@ private:
  */
 class SockDatagram {
 public:
-  SockDatagram(const InetAddr& addr){
+  //With reuse_port, several sockets can be bound to the same address
+  //and the kernel spreads incoming datagrams across them
+  SockDatagram(const InetAddr& addr, bool reuse_port=false){
     handle_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (reuse_port)
+      set_reuse_port(handle_);
     bind(handle_, addr.get_addr(), addr.get_size());
   }
+
+  //Take over an already set up socket
+  SockDatagram(Socket h) {
+    handle_ = h;
+  }
+
+  //Automatically close the handle on destructor
+  ~SockDatagram() {
+    close(handle_);
+  }
     
   Socket get_handle() const{
     return handle_;
@@ -0,0 +1,182 @@
+#if defined (HAS_SPLICE)
+#include "stream_relay.h"
+
+RelayLeg::RelayLeg(StreamRelay* relay, SockStream* stream) {
+  relay_ = relay;
+  sock_stream_ = stream;
+  peer_ = nullptr;
+  pipe_[0] = pipe_[1] = -1;
+  capacity_ = 0;
+  in_pipe_ = 0;
+  eof_ = false;
+  shut_ = false;
+  interest_ = 0;
+}
+
+RelayLeg::~RelayLeg() {
+  if (pipe_[0] >= 0)
+    close(pipe_[0]);
+  if (pipe_[1] >= 0)
+    close(pipe_[1]);
+  delete sock_stream_;
+}
+
+/**
+ * @brief Readable: move data to the peer. Writable: the peer's pipe can
+ * be emptied into this connection.
+ */
+void RelayLeg::handle_event(Socket h, EventType et) {
+  bool ok = true;
+  if ((et & (READ_EVENT | CLOSE_EVENT)) != 0)
+    ok = relay_->pump(this, peer_);
+  if (ok && (et & WRITE_EVENT) == WRITE_EVENT)
+    ok = relay_->pump(peer_, this);
+
+  // A hang-up after both FINs still leaves data to read, which the pump
+  // above has taken care of. Only a reset connection is an error.
+  if (ok && (et & (EXCEPT_EVENT | CLOSE_EVENT)) != 0) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(h, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+      ok = false;
+  }
+
+  if (!ok || (shut_ && peer_->shut_))
+    relay_->close();
+}
+
+Socket RelayLeg::get_handle() const {
+  return sock_stream_->get_handle();
+}
+
+StreamRelay* StreamRelay::create(SockStream* a, SockStream* b, Reactor* reactor) {
+  StreamRelay* relay = new StreamRelay(a, b, reactor);
+  if (!relay->open_) {
+    relay->close();
+    return nullptr;
+  }
+  return relay;
+}
+
+StreamRelay::StreamRelay(SockStream* a, SockStream* b, Reactor* reactor) {
+  reactor_ = reactor;
+  open_ = false;
+  a_ = new RelayLeg(this, a);
+  b_ = new RelayLeg(this, b);
+  a_->peer_ = b_;
+  b_->peer_ = a_;
+
+  RelayLeg* legs[2] = { a_, b_ };
+  for (int i = 0; i < 2; i++) {
+    RelayLeg* leg = legs[i];
+    if (pipe2(leg->pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+      perror("pipe2");
+      return;
+    }
+    // The kernel may give less than asked, e.g. over the per-user limit
+    fcntl(leg->pipe_[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+    int size = fcntl(leg->pipe_[1], F_GETPIPE_SZ);
+    leg->capacity_ = (size > 0) ? size : RELAY_PIPE_SIZE;
+
+    // splice() only leaves the socket side alone if it is non-blocking
+    set_nonblocking(leg->get_handle());
+  }
+
+  open_ = true;
+  for (int i = 0; i < 2; i++) {
+    legs[i]->interest_ = READ_EVENT;
+    reactor_->register_handler(legs[i], READ_EVENT);
+  }
+}
+
+StreamRelay::~StreamRelay() {
+  if (open_) {
+    reactor_->remove_handler(a_, READ_EVENT | WRITE_EVENT);
+    reactor_->remove_handler(b_, READ_EVENT | WRITE_EVENT);
+  }
+  delete a_;
+  delete b_;
+}
+
+/**
+ * @brief Move data received on @a from to @a to until the socket is
+ * drained, the pipe is full and @a to cannot take more, or end of file.
+ * Return false if either connection failed.
+ */
+bool StreamRelay::pump(RelayLeg* from, RelayLeg* to) {
+  ReactorStats& stats = reactor_->stats();
+  bool progress = true;
+  while (progress) {
+    progress = false;
+
+    if (!from->eof_ && from->in_pipe_ < from->capacity_) {
+      ssize_t n = from->sock_stream_->splice_to(from->pipe_[1], from->capacity_ - from->in_pipe_);
+      stats.sys_read++;
+      if (n > 0) {
+        stats.bytes_in += n;
+        from->in_pipe_ += n;
+        progress = true;
+      } else if (n == 0) {
+        from->eof_ = true;
+      } else if (errno == EINTR) {
+        progress = true;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+    }
+
+    if (from->in_pipe_ > 0) {
+      ssize_t n = to->sock_stream_->splice_from(from->pipe_[0], from->in_pipe_);
+      stats.sys_write++;
+      if (n > 0) {
+        stats.bytes_out += n;
+        from->in_pipe_ -= n;
+        progress = true;
+      } else if (n < 0 && errno == EINTR) {
+        progress = true;
+      } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+    }
+  }
+
+  // Everything received before the FIN is through, pass the FIN on
+  if (from->eof_ && from->in_pipe_ == 0 && !to->shut_) {
+    shutdown(to->get_handle(), SHUT_WR);
+    to->shut_ = true;
+  }
+
+  update_interest(from);
+  update_interest(to);
+  return true;
+}
+
+/**
+ * @brief Read a connection while its pipe has room, write it while the
+ * peer's pipe holds data.
+ */
+void StreamRelay::update_interest(RelayLeg* leg) {
+  EventType et = 0;
+  if (!leg->eof_ && leg->in_pipe_ < leg->capacity_)
+    et |= READ_EVENT;
+  if (leg->peer_->in_pipe_ > 0)
+    et |= WRITE_EVENT;
+
+  if (et != leg->interest_) {
+    reactor_->modify_interest(leg, et);
+    leg->interest_ = et;
+  }
+}
+
+/**
+ * @brief Report the end of both connections and delete the relay.
+ */
+void StreamRelay::close() {
+  if (reactor_->tcp_event_handler_ != nullptr) {
+    reactor_->tcp_event_handler_(a_->get_handle(), TCPStateCLOSE);
+    reactor_->tcp_event_handler_(b_->get_handle(), TCPStateCLOSE);
+  }
+  delete this;
+}
+
+#endif // HAS_SPLICE
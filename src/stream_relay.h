@@ -0,0 +1,86 @@
+#ifndef STREAM_RELAY_H_
+#define STREAM_RELAY_H_
+
+#if defined (HAS_SPLICE)
+#include "common.h"
+#include "event_handler.h"
+#include "reactor.h"
+#include "socket_wf.h"
+
+class StreamRelay;
+
+/**
+ * @class RelayLeg
+ *
+ * @brief One connection of a StreamRelay. Data received on it goes through
+ * its pipe to the other leg.
+ */
+class RelayLeg : public EventHandler {
+public:
+  RelayLeg(StreamRelay* relay, SockStream* stream);
+  ~RelayLeg();
+
+  virtual void handle_event(Socket handle, EventType et);
+  virtual Socket get_handle() const;
+
+private:
+  friend class StreamRelay;
+
+  StreamRelay* relay_;
+  SockStream* sock_stream_;
+  RelayLeg* peer_;
+
+  //Data read from this connection and not written to the peer yet
+  int pipe_[2];
+  size_t capacity_;
+  size_t in_pipe_;
+
+  //The connection has no more data to read, and its peer got a FIN
+  bool eof_;
+  bool shut_;
+
+  EventType interest_;
+};
+
+/**
+ * @class StreamRelay
+ *
+ * @brief Forward the bytes of two connections to each other with splice(),
+ * through a pipe per direction, so they are never copied to user space.
+ * A connection is only read while its pipe has room, and only written
+ * while the other one's pipe holds data.
+ *
+ * The relay takes ownership of both streams. Once both directions have
+ * reached end of file or one connection failed, TCPStateCLOSE is reported
+ * for each handle and the relay deletes itself.
+ */
+class StreamRelay {
+public:
+  /**
+   * @brief Relay @a a and @a b on @a reactor. Return nullptr if the pipes
+   * could not be created, in which case both connections are closed as
+   * above.
+   */
+  static StreamRelay* create(SockStream* a, SockStream* b, Reactor* reactor);
+
+  ~StreamRelay();
+
+private:
+  friend class RelayLeg;
+
+  StreamRelay(SockStream* a, SockStream* b, Reactor* reactor);
+
+  bool pump(RelayLeg* from, RelayLeg* to);
+  void update_interest(RelayLeg* leg);
+  void close();
+
+private:
+  Reactor* reactor_;
+  RelayLeg* a_;
+  RelayLeg* b_;
+  bool open_;
+};
+
+#endif // HAS_SPLICE
+
+#endif // STREAM_RELAY_H_
@@ -0,0 +1,141 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined (HAS_EVENTFD)
+#include <sys/eventfd.h>
+#endif // HAS_EVENTFD
+
+#include "task_queue.h"
+#include "reactor.h"
+
+TaskQueue::TaskQueue(Reactor* reactor) {
+  reactor_ = reactor;
+  cells_ = new Cell[TASK_QUEUE_SIZE];
+  mask_ = TASK_QUEUE_SIZE - 1;
+  for (size_t i = 0; i < TASK_QUEUE_SIZE; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  head_ = 0;
+  tail_.store(0, std::memory_order_relaxed);
+  signaled_.store(false, std::memory_order_relaxed);
+
+#if defined (HAS_EVENTFD)
+  wake_fd_ = signal_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0)
+    perror("eventfd");
+#else
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    fds[0] = fds[1] = INVALID_HANDLE_VALUE;
+  } else {
+    for (int i = 0; i < 2; i++) {
+      fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+      fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+  }
+  wake_fd_ = fds[0];
+  signal_fd_ = fds[1];
+#endif // HAS_EVENTFD
+
+  if (wake_fd_ >= 0)
+    reactor->register_handler(this, READ_EVENT);
+}
+
+TaskQueue::~TaskQueue() {
+  if (wake_fd_ >= 0) {
+    reactor_->remove_handler(this, READ_EVENT);
+    close(wake_fd_);
+  }
+  if (signal_fd_ != wake_fd_)
+    close(signal_fd_);
+  delete[] cells_;
+}
+
+bool TaskQueue::post(ReactorTask task, void* arg) {
+  if (task == nullptr || wake_fd_ < 0)
+    return false;
+
+  // Claim a cell: it is free once its sequence number equals the
+  // position, it still holds an older task while below
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    long diff = (long)(seq - pos);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->task = task;
+  cell->arg = arg;
+  cell->seq.store(pos + 1, std::memory_order_release);
+
+  if (!signaled_.exchange(true, std::memory_order_acq_rel))
+    signal();
+  return true;
+}
+
+/**
+ * @brief Take the oldest task, only called by the loop of the Reactor.
+ */
+bool TaskQueue::pop(ReactorTask* task, void** arg) {
+  Cell* cell = &cells_[head_ & mask_];
+  if (cell->seq.load(std::memory_order_acquire) != head_ + 1)
+    return false;
+
+  *task = cell->task;
+  *arg = cell->arg;
+  // Free for the producer which wraps around to it
+  cell->seq.store(head_ + TASK_QUEUE_SIZE, std::memory_order_release);
+  head_++;
+  return true;
+}
+
+void TaskQueue::signal() {
+#if defined (HAS_EVENTFD)
+  uint64_t one = 1;
+  ssize_t n = write(signal_fd_, &one, sizeof(one));
+#else
+  char one = 1;
+  ssize_t n = write(signal_fd_, &one, sizeof(one));
+#endif // HAS_EVENTFD
+  (void) n;
+}
+
+/**
+ * @brief Run the tasks posted so far, up to TASK_BATCH of them.
+ */
+void TaskQueue::handle_event(Socket handle, EventType et) {
+  char buf[64];
+  while (read(wake_fd_, buf, sizeof(buf)) > 0) {
+  }
+
+  // Tasks posted from now on signal again, the exchange also makes
+  // those posted until now visible
+  signaled_.exchange(false, std::memory_order_acq_rel);
+
+  ReactorTask task;
+  void* arg;
+  for (unsigned int i = 0; i < TASK_BATCH; i++) {
+    if (!pop(&task, &arg))
+      return;
+    task(arg);
+  }
+
+  // Tasks are left, come back at the next iteration
+  if (!signaled_.exchange(true, std::memory_order_acq_rel))
+    signal();
+}
+
+Socket TaskQueue::get_handle() const {
+  return wake_fd_;
+}
@@ -0,0 +1,64 @@
+#ifndef TASK_QUEUE_H_
+#define TASK_QUEUE_H_
+
+#include <atomic>
+
+#include "common.h"
+#include "event_handler.h"
+
+class Reactor;
+
+/**
+ * @class TaskQueue
+ *
+ * @brief Tasks posted to a Reactor from any thread, run by its own loop.
+ * Posting is lock-free: tasks go into a bounded ring of TASK_QUEUE_SIZE
+ * cells, each with a sequence number telling producers and the consumer
+ * whose turn it is. The first task posted while the loop is not already
+ * signaled writes to an eventfd (a pipe where there is none) registered
+ * with the Reactor, so the loop wakes up. Up to TASK_BATCH tasks are run
+ * per loop iteration, the rest wait for the next one.
+ */
+class TaskQueue : public EventHandler {
+public:
+  TaskQueue(Reactor* reactor);
+  ~TaskQueue();
+
+  /**
+   * @brief Queue @a task to be called with @a arg. Safe from any thread.
+   * Return false if the queue is full.
+   */
+  bool post(ReactorTask task, void* arg);
+
+  virtual void handle_event(Socket handle, EventType et);
+  virtual Socket get_handle() const;
+
+private:
+  bool pop(ReactorTask* task, void** arg);
+  void signal();
+
+  struct Cell {
+    std::atomic<size_t> seq;
+    ReactorTask task;
+    void* arg;
+  };
+
+private:
+  Reactor* reactor_;
+
+  // Read end and write end, the same descriptor with an eventfd
+  int wake_fd_;
+  int signal_fd_;
+
+  Cell* cells_;
+  size_t mask_;
+
+  // Producers and the consumer do not share cache lines
+  char pad0_[64];
+  std::atomic<size_t> tail_;
+  std::atomic<bool> signaled_;
+  char pad1_[64];
+  size_t head_;
+};
+
+#endif // TASK_QUEUE_H_
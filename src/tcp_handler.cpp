@@ -1,20 +1,55 @@
+#include <netinet/tcp.h>
+
 #include "tcp_handler.h"
 
-TcpHandler::TcpHandler(SockStream* stream, Reactor* reactor) {
+TcpHandler::TcpHandler(SockStream* stream, Reactor* reactor)
+  : framer_(reactor->get_buffer_pool()) {
   // TODO: can we use assignment operator for reference variable
   sock_stream_ = stream;
   reactor_ = reactor;
+  serial_ = reactor->next_serial();
+  peer_closed_ = false;
+  out_offset_ = out_size_ = 0;
+  spare_block_ = nullptr;
+  over_high_ = false;
+  interest_ = READ_EVENT;
+  closed_ = false;
+  nonblocking_ = reactor->is_edge_triggered();
+
+  zerocopy_ = false;
+  zc_next_ = zc_done_ = 0;
+  zc_copied_ = 0;
+#if defined (HAS_ZEROCOPY)
+  if (reactor->get_config().tcp_zerocopy_threshold > 0)
+    zerocopy_ = stream->set_zerocopy();
+#endif // HAS_ZEROCOPY
+
+  reactor->set_stream(stream->get_handle(), this);
   reactor->register_handler(this, READ_EVENT);
-  
-  //  memset(sip_msg_.big_buff, 0x00, sizeof(sip_msg_.big_buff));
-  //  sip_msg_.is_reading_body = false;
-  //  sip_msg_.remain_body_len = 0;
 }
 
 TcpHandler::~TcpHandler() {
-  // Remove itself from demultiplexer table of Reactor
-  reactor_->remove_handler(this, READ_EVENT);
-  
+  if (!closed_)
+    detach();
+
+  // Blocks of zero-copy writes still in flight may only be released once
+  // the kernel completes them, the reaper keeps the socket open until then
+  if (!zc_blocks_.empty())
+    reap_zerocopy();
+  while (!out_blocks_.empty()) {
+    OutBlock* block = out_blocks_.pop_front();
+    if (block->pinned)
+      zc_blocks_.push_back(block);
+    else
+      release_block(block);
+  }
+  free(spare_block_);
+
+  if (!zc_blocks_.empty()) {
+    reactor_->get_zerocopy_reaper()->adopt(sock_stream_, zc_blocks_, zc_done_);
+    return;
+  }
+
   // Former action requires socket descriptor which get from mSockStream
   // so we remove this SOCK_Stream object latter
   delete sock_stream_;
@@ -25,14 +60,26 @@ TcpHandler::~TcpHandler() {
  */
 void TcpHandler::handle_event(Socket h, EventType et) {
   if ((et & READ_EVENT) == READ_EVENT) {
+    // Together with CLOSE_EVENT, the peer has closed its side
+    // and we close as soon as the socket is drained
+    peer_closed_ = (et & CLOSE_EVENT) == CLOSE_EVENT;
+
+    // poll() reports both at once, write first as reading may close
+    if ((et & WRITE_EVENT) == WRITE_EVENT && !write_queue()) {
+      handle_close(h);
+      return;
+    }
+
     // Save received data to internal buffer and process it
     handle_read(h);
   } else if ((et & WRITE_EVENT) == WRITE_EVENT) {
     handle_write(h);
   } else if ((et & EXCEPT_EVENT) == EXCEPT_EVENT) {
+    handle_except(h);
+  } else if ((et & CLOSE_EVENT) == CLOSE_EVENT) {
     // This object is allocated by ConnectionAcceptor object, so
     // we deallocate it here if event is CLOSE
-    handle_except(h);
+    handle_close(h);
   }
 }
 
@@ -40,146 +87,625 @@ Socket TcpHandler::get_handle() const {
   return sock_stream_->get_handle();
 }
 
+bool TcpHandler::is_completion_aware() const {
+  return true;
+}
+
+/**
+ * @brief Data already received by a completion-based demultiplexer.
+ * It is copied into the receive buffer to be split into messages.
+ */
+void TcpHandler::handle_input(Socket handle, char* data, size_t len,
+                              struct sockaddr_in* peer) {
+  reactor_->stats().bytes_in += len;
+  while (len > 0) {
+    size_t n = framer_.append(data, len);
+    if (n == 0) {
+      // Buffer is full but holds no complete message
+      handle_close(handle);
+      return;
+    }
+    data += n;
+    len -= n;
+
+    if (!dispatch_messages(handle))
+      return;
+  }
+}
+
 /**
  * @brief Read message from clients and call to user callback. 
- * In case of TCP, we need to read until to delimiter of data stream.
+ * In case of TCP, we need to read until to delimiter of data stream:
+ * data is read straight into the receive buffer, then every complete
+ * message is passed to the user callback.
  */
 void TcpHandler::handle_read(Socket handle) {
-  /*
-  ssize_t n;
-  int contlen_value;
-  bool is_valid = false;   //Check Content-Length value is valid or not
-  char buff[TEMP_MSG_SIZE]; //buffer for each time read from kernel
-  char* emptyline, *contlen_begin, *contlen_end;
-  memset(buff, 0x00, sizeof(buff));
-
-  /////////////////////////////////////////////////////////
-  //// We've already read headers. Now we are reading body.
-  //// Read until the end of body, save to big buff and
-  //// return to user's callback function.
-  /////////////////////////////////////////////////////////
-  if(sip_msg_.is_reading_body == true){
-    if(sip_msg_.remain_body_len > TEMP_MSG_SIZE)
-      n = read(handle, buff, sizeof(buff));
-    else
-      n = read(handle, buff, sip_msg_.remain_body_len);
+  bool drain = reactor_->is_edge_triggered();
 
-    if((n < 0 && errno == ECONNRESET) || (n == 0)) {
+  for (;;) {
+    struct iovec iov[2];
+    int count = framer_.get_free(iov);
+    if (count == 0) {
       handle_close(handle);
       return;
     }
-    if(n < sip_msg_.remain_body_len)
-      sip_msg_.remain_body_len = sip_msg_.remain_body_len - n;
-    strncat(sip_msg_.big_buff, buff, strlen(buff));
-
-    //Call to user's callback function
-    //mReactor->mGetReactorImpl()->mTCPReadHandler(handle, mSipMsg.mBigBuff, strlen(mSipMsg.mBigBuff));
-    reactor_->tcp_read_handler_(handle, sip_msg_.big_buff, strlen(sip_msg_.big_buff));
-
-    memset(sip_msg_.big_buff, 0x00, sizeof(sip_msg_.big_buff));
-    sip_msg_.is_reading_body = false;
-    sip_msg_.remain_body_len = 0;
-
-    //////////////////////////////////////////////////////////////
-    //// We are still reading headers. If we found empty line,
-    //// save these header bytes and move to read body. Else,
-    //// save all read header bytes to big buff and continue read
-    //////////////////////////////////////////////////////////////
-  }else if(sip_msg_.is_reading_body == false){
-    n = read(handle, buff, sizeof(buff));
-    if((n < 0 && errno == ECONNRESET) || (n == 0)){
+
+    // An error queue holding only zero-copy completions makes a blocking
+    // socket look readable to select()
+    ssize_t n = sock_stream_->recvv(iov, count, zerocopy_ ? MSG_DONTWAIT : 0);
+    reactor_->stats().sys_read++;
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // select() reports zero-copy completions as readable
+      if (!zc_blocks_.empty())
+        reap_zerocopy();
+      if (peer_closed_)
+        handle_close(handle);
+      return;
+    }
+
+    if (n <= 0) {
       handle_close(handle);
       return;
     }
-    if((emptyline = strstr(buff, "\r\n\r\n")) != NULL){
-      //      pantheios::log_INFORMATIONAL("Found empty line");
-      sip_msg_.is_reading_body = true;
-      int m = (emptyline + 4 - &buff[0]);
-      strncat(sip_msg_.big_buff, buff, m);
-      int l = strlen(sip_msg_.big_buff);
-      char inter[l+1];
-      strncpy(inter, sip_msg_.big_buff, l);
-      inter[l+1] = '\0';
-
-      for(int j = 0; j < l; j++)
-        inter[j] = tolower(inter[j]);
-        
-      if((contlen_begin = strstr(inter, "content-length")) == NULL){
-        if((contlen_begin = strstr(inter, "\r\nl")) == NULL){
-          //          pantheios::log_INFORMATIONAL("Not found Content-Length header");
-          handle_close(handle);
-          return;
-        }
-      }
 
-      //pantheios::log_INFORMATIONAL("Found Content-Length");
-      if((contlen_end = strstr(contlen_begin, "\r\n")) != NULL){
-        for(int i = 0; i < ((contlen_end-contlen_begin)/sizeof(char)); i++){
-          if(isdigit(*(contlen_begin + i))){
-            contlen_value = atoi(contlen_begin + i);
-            is_valid = true;
-            break;
-          }         
-        }
-        if(is_valid == false) {
-          //handle invalid Content-Length value case
-          //pantheios::log_INFORMATIONAL("Invalid Content Length !!!");
-          handle_close(handle);
-          return;
-        }
+    reactor_->stats().bytes_in += n;
+    framer_.commit(n);
+    if (!dispatch_messages(handle))
+      return;
+
+    // A short read has emptied the socket, so there is no need
+    // to wait for EAGAIN or for read() to return 0
+    size_t room = iov[0].iov_len + ((count > 1) ? iov[1].iov_len : 0);
+    if ((size_t)n < room) {
+      if (peer_closed_)
+        handle_close(handle);
+      return;
+    }
+
+    if (!drain)
+      return;
+  }
+}
+
+/**
+ * @brief Pass every complete message to the user callback, and answer
+ * keepalives. Return false if the connection was closed.
+ */
+bool TcpHandler::dispatch_messages(Socket handle) {
+  for (;;) {
+    char* msg;
+    size_t len;
+
+    switch (framer_.next(&msg, &len)) {
+    case SipFramer::MESSAGE:
+      reactor_->stats().messages_in++;
+      reactor_->deliver_stream(handle, serial_, msg, len);
+      break;
+
+    case SipFramer::PING:
+      // RFC 5626: answer a double CRLF with a single CRLF
+      send("\r\n", 2);
+      break;
+
+    case SipFramer::ERROR:
+      handle_close(handle);
+      return false;
+
+    default:
+      return true;
+    }
+  }
+}
+
+
+bool TcpHandler::send(const char* data, size_t len) {
+  return enqueue(data, len, nullptr, nullptr);
+}
+
+bool TcpHandler::send(const char* data, size_t len, ReactorBufferRelease release, void* arg) {
+  return enqueue(data, len, release, arg);
+}
+
+#if defined (HAS_SENDFILE)
+bool TcpHandler::send_file(int fd, off_t offset, size_t len, ReactorBufferRelease release, void* arg) {
+  if (!nonblocking_) {
+    set_nonblocking(get_handle());
+    nonblocking_ = true;
+  }
+
+  const ReactorConfig& config = reactor_->get_config();
+  if (out_size_ + len > config.tcp_out_max) {
+    reactor_->stats().drops++;
+    return false;
+  }
+  reactor_->stats().messages_out++;
+
+  if (out_size_ == 0 && (interest_ & WRITE_EVENT) == 0)
+    reactor_->defer_flush(this);
+
+  OutBlock* block = new_block(nullptr, len, release, arg);
+  if (block == nullptr)
+    return false;
+  block->file = fd;
+  block->file_offset = offset;
+  out_blocks_.push_back(block);
+  out_size_ += len;
+  check_high_watermark();
+  return true;
+}
+#else
+bool TcpHandler::send_file(int fd, off_t offset, size_t len, ReactorBufferRelease release, void* arg) {
+  const ReactorConfig& config = reactor_->get_config();
+  if (out_size_ + len > config.tcp_out_max)
+    return false;
+
+  char buff[TCP_OUT_BLOCK_SIZE];
+  while (len > 0) {
+    size_t count = (len < sizeof(buff)) ? len : sizeof(buff);
+    ssize_t n = pread(fd, buff, count, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      perror("pread");
+      return false;
+    }
+    if (!enqueue(buff, n, nullptr, nullptr))
+      return false;
+    offset += n;
+    len -= n;
+  }
+
+  if (release != nullptr)
+    release(arg);
+  return true;
+}
+#endif // HAS_SENDFILE
+
+/**
+ * @brief Append to the output queue. Without @a release the data is copied
+ * into the queue's own blocks, otherwise it is referenced as a block of
+ * its own.
+ */
+bool TcpHandler::enqueue(const char* data, size_t len, ReactorBufferRelease release, void* arg) {
+  const ReactorConfig& config = reactor_->get_config();
+  if (out_size_ + len > config.tcp_out_max) {
+    reactor_->stats().drops++;
+    return false;
+  }
+  reactor_->stats().messages_out++;
+
+  // The first bytes queued ask for a flush, unless the socket is
+  // already waiting to become writable
+  if (out_size_ == 0 && (interest_ & WRITE_EVENT) == 0)
+    reactor_->defer_flush(this);
+
+  if (release != nullptr) {
+    OutBlock* block = new_block((char*) data, len, release, arg);
+    if (block == nullptr)
+      return false;
+    out_blocks_.push_back(block);
+    out_size_ += len;
+    len = 0;
+  }
+
+  while (len > 0) {
+    OutBlock* last = out_blocks_.tail;
+    if (last == nullptr || last->release != nullptr ||
+        last->file >= 0 || last->len == TCP_OUT_BLOCK_SIZE) {
+      char* buff = spare_block_;
+      spare_block_ = nullptr;
+      if (buff == nullptr)
+        buff = (char*) malloc(TCP_OUT_BLOCK_SIZE);
+      if (buff == nullptr) {
+        perror("malloc");
+        return false;
       }
-      //pantheios::log_INFORMATIONAL("Content-Length: ", pantheios::integer(contlen_value));
-
-      //the number of body bytes in buff[] now is (n-m) bytes.
-      //n is the number of read bytes, m is the number of bytes til to end of empty line
-      //NOTE: buff[] can also contain a beginning of subsequent message with current message
-      //we are reading. So we need to save this message for further reading.
-      if(contlen_value > (n-m)){
-        strncat(sip_msg_.big_buff, emptyline+4, (n-m));
-        sip_msg_.remain_body_len = sip_msg_.remain_body_len - (n-m);
-      }else{
-        //if (n-m) > contlen_value, it means that there are bytes of other
-        //message in buff[], we need to save this bytes for that message.
-        strncat(sip_msg_.big_buff, emptyline+4, contlen_value);
-
-        //Call to user's callback function
-        //mReactor->mGetReactorImpl()->mTCPReadHandler(handle, mSipMsg.mBigBuff, strlen(mSipMsg.mBigBuff));
-        reactor_->tcp_read_handler_(handle, sip_msg_.big_buff, strlen(sip_msg_.big_buff));
-
-        memset(sip_msg_.big_buff, 0x00, sizeof(sip_msg_.big_buff));
-        sip_msg_.is_reading_body = false;
-        sip_msg_.remain_body_len = 0;
+      last = new_block(buff, 0, nullptr, nullptr);
+      if (last == nullptr) {
+        spare_block_ = buff;
+        return false;
       }
-    }else{
-      //Empty line is not present in buff[]. Save buff to mBigBuff
-      strncat(sip_msg_.big_buff, buff, n);
+      out_blocks_.push_back(last);
     }
+
+    size_t n = TCP_OUT_BLOCK_SIZE - last->len;
+    if (n > len)
+      n = len;
+    memcpy(last->data + last->len, data, n);
+    last->len += n;
+    out_size_ += n;
+    data += n;
+    len -= n;
   }
-  */
+
+  check_high_watermark();
+  return true;
 }
 
+/**
+ * @brief Queue node from the block pool of the Reactor, nullptr if out of
+ * memory.
+ */
+TcpHandler::OutBlock* TcpHandler::new_block(char* data, size_t len,
+                                            ReactorBufferRelease release, void* arg) {
+  OutBlock* block = (OutBlock*) ObjectPool::allocate(reactor_->get_block_pool(),
+                                                     sizeof(OutBlock));
+  if (block == nullptr) {
+    perror("malloc");
+    return nullptr;
+  }
+  block->data = data;
+  block->len = len;
+  block->release = release;
+  block->arg = arg;
+  block->pinned = false;
+  block->zc_id = 0;
+  block->file = -1;
+  block->file_offset = 0;
+  block->next = nullptr;
+  return block;
+}
+
+void TcpHandler::check_high_watermark() {
+  if (!over_high_ && out_size_ >= reactor_->get_config().tcp_high_watermark) {
+    over_high_ = true;
+    if (reactor_->tcp_event_handler_ != nullptr)
+      reactor_->tcp_event_handler_(get_handle(), TCPStateOVERFLOW);
+  }
+}
+
+void TcpHandler::handle_flush() {
+  if (!write_queue())
+    handle_close(get_handle());
+}
+
+/**
+ * @brief Write the output queue until it is empty or the socket buffer is
+ * full, in which case WRITE_EVENT is registered. MSG_MORE tells the kernel
+ * more follows when the queue takes several calls. Return false if the
+ * connection failed.
+ */
+bool TcpHandler::write_queue() {
+  if (!zc_blocks_.empty())
+    reap_zerocopy();
+
+  while (out_size_ > 0) {
+#if defined (HAS_SENDFILE)
+    if (out_blocks_.head->file >= 0) {
+      bool blocked;
+      if (!write_file(&blocked))
+        return false;
+      if (blocked)
+        break;
+      continue;
+    }
+#endif // HAS_SENDFILE
+
+    struct iovec iov[TCP_OUT_IOV];
+    int count = 0;
+    size_t total = 0;
+    // A file range ends the gather list, it needs sendfile()
+    for (OutBlock* block = out_blocks_.head; block != nullptr && count < (int)TCP_OUT_IOV &&
+           block->file < 0; block = block->next) {
+      size_t begin = (count == 0) ? out_offset_ : 0;
+      iov[count].iov_base = block->data + begin;
+      iov[count].iov_len = block->len - begin;
+      total += block->len - begin;
+      count++;
+    }
+
+    int flags = MSG_DONTWAIT | ((total < out_size_) ? MSG_MORE : 0);
+#if defined (HAS_ZEROCOPY)
+    bool zerocopy = zerocopy_ && total >= reactor_->get_config().tcp_zerocopy_threshold;
+    if (zerocopy)
+      flags |= MSG_ZEROCOPY;
+#endif // HAS_ZEROCOPY
+
+    ssize_t n = sock_stream_->sendv(iov, count, flags);
+#if defined (HAS_ZEROCOPY)
+    if (n < 0 && errno == ENOBUFS && zerocopy) {
+      // No room left for the completion notification, copy this time
+      zerocopy = false;
+      n = sock_stream_->sendv(iov, count, flags & ~MSG_ZEROCOPY);
+    }
+#endif // HAS_ZEROCOPY
+    reactor_->stats().sys_write++;
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return false;
+
+#if defined (HAS_ZEROCOPY)
+    if (zerocopy && n >= 0) {
+      // Every successful zero-copy call gets the next id, the blocks it
+      // covered are kept until that id is completed
+      size_t covered = 0;
+      OutBlock* block = out_blocks_.head;
+      for (int i = 0; i < count && covered < (size_t)n; i++, block = block->next) {
+        block->pinned = true;
+        block->zc_id = zc_next_;
+        covered += iov[i].iov_len;
+      }
+      zc_next_++;
+    }
+#endif // HAS_ZEROCOPY
+
+    if (n > 0) {
+      reactor_->stats().bytes_out += n;
+      consume(n);
+    }
+
+    // A short write means the socket buffer is full as well
+    if (n < 0 || (size_t)n < total) {
+      if ((interest_ & WRITE_EVENT) == 0)
+        set_interest(interest_ | WRITE_EVENT);
+      break;
+    }
+  }
+
+  if (out_size_ == 0 && (interest_ & WRITE_EVENT) != 0)
+    set_interest(interest_ & ~WRITE_EVENT);
+
+  if (over_high_ && out_size_ <= reactor_->get_config().tcp_low_watermark) {
+    over_high_ = false;
+    if (reactor_->tcp_event_handler_ != nullptr)
+      reactor_->tcp_event_handler_(get_handle(), TCPStateDRAINED);
+  }
+  return true;
+}
+
+#if defined (HAS_SENDFILE)
+/**
+ * @brief Write the file range at the front of the queue, TCP_SENDFILE_CHUNK
+ * bytes at most so that a large file does not hold up the loop. Set
+ * @a blocked if the socket buffer is full. Return false if the connection
+ * failed or the file is shorter than queued.
+ */
+bool TcpHandler::write_file(bool* blocked) {
+  const OutBlock& front = *out_blocks_.head;
+  off_t offset = front.file_offset + out_offset_;
+  size_t total = front.len - out_offset_;
+  if (total > TCP_SENDFILE_CHUNK)
+    total = TCP_SENDFILE_CHUNK;
+
+  ssize_t n;
+  do {
+    n = sock_stream_->send_file(front.file, &offset, total);
+    reactor_->stats().sys_write++;
+  } while (n < 0 && errno == EINTR);
+
+  if (n == 0)
+    return false;
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return false;
+
+  if (n > 0) {
+    reactor_->stats().bytes_out += n;
+    consume(n);
+  }
+  *blocked = n < 0 || (size_t)n < total;
+  if (*blocked && (interest_ & WRITE_EVENT) == 0)
+    set_interest(interest_ | WRITE_EVENT);
+  return true;
+}
+#endif // HAS_SENDFILE
+
+/**
+ * @brief Drop @a len written bytes from the front of the output queue.
+ * Blocks referenced by a zero-copy write wait for its completion.
+ */
+void TcpHandler::consume(size_t len) {
+  out_size_ -= len;
+  while (len > 0) {
+    OutBlock* front = out_blocks_.head;
+    if (len < front->len - out_offset_) {
+      out_offset_ += len;
+      return;
+    }
+
+    len -= front->len - out_offset_;
+    out_blocks_.pop_front();
+    if (front->pinned)
+      zc_blocks_.push_back(front);
+    else
+      release_block(front);
+    out_offset_ = 0;
+  }
+}
+
+/**
+ * @brief Give the data of a block back to its owner and the node to its
+ * pool. One of the queue's own buffers is kept for the next send().
+ */
+void TcpHandler::release_block(OutBlock* block) {
+  if (block->release != nullptr)
+    block->release(block->arg);
+  else if (block->file < 0 && spare_block_ == nullptr)
+    spare_block_ = block->data;
+  else if (block->file < 0)
+    free(block->data);
+  ObjectPool::release(block);
+}
 
 /**
- * @brief Handler for ready-to-write event.
+ * @brief Read the zero-copy completions from the socket error queue and
+ * release the blocks of the completed writes. Completions come in order.
+ */
+void TcpHandler::reap_zerocopy() {
+#if defined (HAS_ZEROCOPY)
+  unsigned int lo, hi;
+  bool copied;
+  int result;
+  while ((result = sock_stream_->recv_zerocopy(&lo, &hi, &copied)) >= 0) {
+    if (result == 0)
+      continue;
+    if ((int)(hi + 1 - zc_done_) > 0)
+      zc_done_ = hi + 1;
+    if (copied)
+      zc_copied_ += hi - lo + 1;
+  }
+
+  while (!zc_blocks_.empty() && (int)(zc_blocks_.head->zc_id - zc_done_) < 0) {
+    release_block(zc_blocks_.pop_front());
+  }
+#endif // HAS_ZEROCOPY
+}
+
+/**
+ * @brief Handler for ready-to-write event, the socket buffer has room
+ * again for the output queue.
  */
 void TcpHandler::handle_write(Socket handle) {
-  // Ignore this event because we only register READ_EVENT to Reactor
+  if (!write_queue())
+    handle_close(handle);
+}
+
+void TcpHandler::set_interest(EventType et) {
+  if (closed_)
+    return;
+  reactor_->modify_interest(this, et);
+  interest_ = et;
 }
 
 /**
  * @brief Handle close event.
  */
 void TcpHandler::handle_close(Socket handle) {
+  // Last chance for pending output, e.g. the answer to a request sent
+  // just before the peer shut down its side
+  if (out_size_ > 0)
+    write_queue();
+
   // NOTE: Do not use "delete this" for class that can be instantiated
   // in stack because it is automatic variable and when program go out
   // of its scope, its destructor is call second time. In that case,
   // the result is undefined.
-  delete this;
+  if (Reactor::current() != reactor_) {
+    delete this;
+    return;
+  }
+
+  // From the loop, the handle stays open until the end of the iteration
+  // so events left in the batch cannot reach another connection
+  detach();
+  reactor_->defer_delete(this);
+}
+
+/**
+ * @brief Stop receiving events and leave the Reactor's tables.
+ */
+void TcpHandler::detach() {
+  closed_ = true;
+  reactor_->cancel_flush(this);
+  reactor_->set_stream(get_handle(), nullptr);
+
+  // Remove itself from demultiplexer table of Reactor
+  reactor_->remove_handler(this, interest_);
 }
 
 /*
- * @brief Handle other events.
+ * @brief An error without data to read: zero-copy completions queued on
+ * the socket error queue, or a failed connection.
  */
 void TcpHandler::handle_except(Socket handle) {
-  // Ignore this event because we only register READ_EVENT to Reactor
+  reap_zerocopy();
+
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(handle, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+    handle_close(handle);
+}
+
+ZerocopyReaper::ZerocopyReaper(Reactor* reactor) {
+  reactor_ = reactor;
+  timer_ = 0;
+}
+
+ZerocopyReaper::~ZerocopyReaper() {
+  for (size_t i = 0; i < sockets_.size(); i++) {
+    reap(sockets_[i]);
+    // The kernel may still read what is left: it is given up, not released
+    delete sockets_[i]->stream;
+    delete sockets_[i];
+  }
+  if (timer_ != 0)
+    reactor_->cancel_timer(timer_);
+}
+
+void ZerocopyReaper::adopt(SockStream* stream, TcpHandler::BlockList& blocks,
+                           unsigned int done) {
+  Lingering* lingering = new Lingering();
+  lingering->stream = stream;
+  lingering->blocks = blocks;
+  blocks = TcpHandler::BlockList();
+  lingering->done = done;
+
+  // Close does not wait for the data either, the FIN follows it now
+  Socket handle = stream->get_handle();
+  shutdown(handle, SHUT_WR);
+#if defined (TCP_USER_TIMEOUT)
+  unsigned int timeout = ZEROCOPY_LINGER_MS;
+  setsockopt(handle, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+#endif // TCP_USER_TIMEOUT
+
+  if (reap(lingering)) {
+    delete stream;
+    delete lingering;
+    return;
+  }
+  sockets_.push_back(lingering);
+  if (timer_ == 0)
+    timer_ = reactor_->schedule_timer(ZEROCOPY_REAP_MS, on_timer, this);
+}
+
+void ZerocopyReaper::on_timer(TimerId id, void* arg) {
+  ZerocopyReaper* reaper = (ZerocopyReaper*) arg;
+  size_t kept = 0;
+  for (size_t i = 0; i < reaper->sockets_.size(); i++) {
+    Lingering* lingering = reaper->sockets_[i];
+    if (reap(lingering)) {
+      delete lingering->stream;
+      delete lingering;
+    } else {
+      reaper->sockets_[kept++] = lingering;
+    }
+  }
+  reaper->sockets_.resize(kept);
+
+  reaper->timer_ = 0;
+  if (kept > 0)
+    reaper->timer_ = reaper->reactor_->schedule_timer(ZEROCOPY_REAP_MS, on_timer, reaper);
+}
+
+/**
+ * @brief Read the completions of a lingering socket and release the blocks
+ * they cover. Return true once none is left.
+ */
+bool ZerocopyReaper::reap(Lingering* lingering) {
+#if defined (HAS_ZEROCOPY)
+  unsigned int lo, hi;
+  bool copied;
+  int result;
+  while ((result = lingering->stream->recv_zerocopy(&lo, &hi, &copied)) >= 0) {
+    if (result != 0 && (int)(hi + 1 - lingering->done) > 0)
+      lingering->done = hi + 1;
+  }
+#endif // HAS_ZEROCOPY
+
+  TcpHandler::BlockList& blocks = lingering->blocks;
+  while (!blocks.empty() && (int)(blocks.head->zc_id - lingering->done) < 0) {
+    release(blocks.pop_front());
+  }
+  return blocks.empty();
+}
+
+void ZerocopyReaper::release(TcpHandler::OutBlock* block) {
+  if (block->release != nullptr)
+    block->release(block->arg);
+  else if (block->file < 0)
+    free(block->data);
+  ObjectPool::release(block);
 }
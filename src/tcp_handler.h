@@ -5,35 +5,259 @@
 #include "event_handler.h"
 #include "reactor.h"
 #include "socket_wf.h"
+#include "sip_framer.h"
 
 /**
  * @class TcpHandler
  *
  * @brief Receive and process data from TCP clients. Each object
- * of this class handles data stream from a TCP connection.
+ * of this class handles data stream from a TCP connection, and calls
+ * the user callback once per complete SIP message.
+ *
+ * Output goes through a queue of TCP_OUT_BLOCK_SIZE blocks. Everything
+ * queued during a loop iteration is written at its end by one sendmsg(),
+ * and WRITE_EVENT is only registered while the socket buffer is full.
+ *
+ * With ReactorConfig::tcp_zerocopy_threshold set, writes of at least that
+ * many bytes use MSG_ZEROCOPY. The blocks they cover are kept until the
+ * kernel reports on the socket error queue that it is done with them.
+ * A connection destroyed before that hands its socket and those blocks
+ * to the ZerocopyReaper of its Reactor.
+ *
+ * File ranges queued by send_file() are written with sendfile(), straight
+ * from the page cache, in order with the rest of the output.
+ *
+ * Accepted connections are allocated, with their SockStream, from the
+ * pools of their Reactor and recycled when they close. So are the nodes
+ * of the output queue, a connection which sends nothing allocates none.
  */
 class TcpHandler : public EventHandler {
 public:
   TcpHandler(SockStream* stream, Reactor* reactor);
   ~TcpHandler();
+
+  /**
+   * @brief Allocated from @a pool, e.g. Reactor::get_handler_pool() of
+   * the accepting Reactor, or from the heap. Both are freed by delete.
+   */
+  static void* operator new(size_t size, ObjectPool* pool) {
+    return pool_new(pool, size);
+  }
+  static void* operator new(size_t size) {
+    return pool_new(nullptr, size);
+  }
+  static void operator delete(void* p, ObjectPool* pool) {
+    ObjectPool::release(p);
+  }
+  static void operator delete(void* p) {
+    ObjectPool::release(p);
+  }
   
   virtual void handle_event(Socket handle, EventType et);
   virtual Socket get_handle() const;
 
+  virtual bool is_completion_aware() const;
+  virtual void handle_input(Socket handle, char* data, size_t len,
+                            struct sockaddr_in* peer);
+
+  /**
+   * @brief Queue @a data for the peer, it is written at the end of the loop
+   * iteration. Return false if more than ReactorConfig::tcp_out_max bytes
+   * are already queued.
+   */
+  bool send(const char* data, size_t len);
+
+  /**
+   * @brief Queue @a data without copying it. @a release is called with
+   * @a arg once the kernel no longer needs the data, which may be after
+   * this handler is gone. It is not called if false is returned.
+   */
+  bool send(const char* data, size_t len, ReactorBufferRelease release, void* arg);
+
+  /**
+   * @brief Queue @a len bytes of file @a fd from @a offset. The descriptor
+   * must stay open until @a release is called with @a arg; it is not called
+   * if false is returned. Without sendfile() the range is read and copied
+   * into the queue right away.
+   */
+  bool send_file(int fd, off_t offset, size_t len, ReactorBufferRelease release, void* arg);
+
+  /**
+   * @brief Write the output queue. Called by the Reactor.
+   */
+  virtual void handle_flush();
+
+  /**
+   * @brief Tells this connection apart from others which had its handle.
+   */
+  unsigned long long serial() const {
+    return serial_;
+  }
+
+  /**
+   * @brief Bytes queued and not written yet.
+   */
+  size_t pending() const {
+    return out_size_;
+  }
+
+  /**
+   * @brief Zero-copy writes for which the kernel fell back to copying,
+   * e.g. over loopback.
+   */
+  unsigned long zerocopy_copied_count() const {
+    return zc_copied_;
+  }
+
 protected:
   virtual void handle_read(Socket handle);
   virtual void handle_write(Socket handle);
   virtual void handle_close(Socket handle);
   virtual void handle_except(Socket handle);
 
+private:
+  friend class Reactor;
+  friend class ZerocopyReaper;
+
+  void detach();
+  bool dispatch_messages(Socket handle);
+  bool write_queue();
+  bool write_file(bool* blocked);
+  void check_high_watermark();
+  void consume(size_t len);
+  void set_interest(EventType et);
+  bool enqueue(const char* data, size_t len, ReactorBufferRelease release, void* arg);
+  void reap_zerocopy();
+
+  struct OutBlock {
+    char* data;
+    size_t len;                 // Bytes filled
+    ReactorBufferRelease release; // nullptr for the queue's own blocks
+    void* arg;
+    bool pinned;                // Referenced by a zero-copy write
+    unsigned int zc_id;         // Last zero-copy write referencing it
+    int file;                   // File range instead of data, -1 otherwise
+    off_t file_offset;
+    OutBlock* next;
+  };
+
+  // Blocks in queue order, linked through OutBlock::next
+  struct BlockList {
+    OutBlock* head;
+    OutBlock* tail;
+
+    BlockList() : head(nullptr), tail(nullptr) {
+    }
+
+    bool empty() const {
+      return head == nullptr;
+    }
+
+    void push_back(OutBlock* block) {
+      block->next = nullptr;
+      if (tail != nullptr)
+        tail->next = block;
+      else
+        head = block;
+      tail = block;
+    }
+
+    OutBlock* pop_front() {
+      OutBlock* block = head;
+      head = block->next;
+      if (head == nullptr)
+        tail = nullptr;
+      return block;
+    }
+  };
+
+  OutBlock* new_block(char* data, size_t len, ReactorBufferRelease release, void* arg);
+  void release_block(OutBlock* block);
+
 private:
   //Receives data from a connected client
   SockStream* sock_stream_;
   
   //Store process-wide Reactor instance
   Reactor* reactor_;
-  
-  //  struct SipMsgBuff sip_msg_;
+  unsigned long long serial_;
+
+  //Peer has closed its side, close once pending data is read
+  bool peer_closed_;
+
+  //Receive buffer, split into SIP messages
+  SipFramer framer_;
+
+  //Output queue, the first block is pending from out_offset_
+  BlockList out_blocks_;
+  size_t out_offset_;
+  size_t out_size_;
+  char* spare_block_;
+
+  //Zero-copy writes: blocks written but not released by the kernel yet,
+  //id of the next write and of the first one not completed
+  bool zerocopy_;
+  BlockList zc_blocks_;
+  unsigned int zc_next_;
+  unsigned int zc_done_;
+  unsigned long zc_copied_;
+
+  //Output is above the high watermark, until it drops to the low one
+  bool over_high_;
+
+  EventType interest_;
+
+  //Closed, only waiting to be deleted by the Reactor
+  bool closed_;
+
+  //sendfile() has no flag to keep it from blocking
+  bool nonblocking_;
+};
+
+/**
+ * @class ZerocopyReaper
+ *
+ * @brief Sockets of closed connections whose zero-copy writes are not
+ * completed yet. Each is shut down for writing and kept open, so that
+ * its error queue can still be read, and polled every ZEROCOPY_REAP_MS
+ * from a timer of the Reactor. The blocks are released as the kernel
+ * completes the writes, then the socket is closed. TCP_USER_TIMEOUT
+ * bounds the wait for a peer which stopped acknowledging: the kernel
+ * then resets the connection and completes the writes. Blocks still
+ * pinned when the Reactor is destroyed are never released.
+ */
+class ZerocopyReaper {
+public:
+  ZerocopyReaper(Reactor* reactor);
+  ~ZerocopyReaper();
+
+  /**
+   * @brief Take over @a stream and the @a blocks pinned by its zero-copy
+   * writes, those with an id before @a done being completed already.
+   */
+  void adopt(SockStream* stream, TcpHandler::BlockList& blocks, unsigned int done);
+
+  /**
+   * @brief Sockets still waiting for completions.
+   */
+  size_t size() const {
+    return sockets_.size();
+  }
+
+private:
+  struct Lingering {
+    SockStream* stream;
+    TcpHandler::BlockList blocks;
+    unsigned int done;
+  };
+
+  static void on_timer(TimerId id, void* arg);
+  static bool reap(Lingering* lingering);
+  static void release(TcpHandler::OutBlock* block);
+
+  Reactor* reactor_;
+  std::vector<Lingering*> sockets_;
+  TimerId timer_;
 };
 
 #endif // TCP_HANDLER_H_
@@ -1,18 +1,258 @@
+#include <stdint.h>
+
 #include "timer.h"
 
 TimerList* TimerList::instance_ = nullptr;
 
-TimerList::TimerList() {
-  timer_t timer;
+unsigned long long monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Index of the first slot of a level in heads_
+static inline unsigned int level_base(unsigned int level) {
+  return (level == 0) ? 0 : WHEEL_L0_SIZE + (level - 1) * WHEEL_LN_SIZE;
+}
+
+// Number of low bits of a tick below the slot index of a level
+static inline unsigned int level_shift(unsigned int level) {
+  return (level == 0) ? 0 : WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+}
+
+// Slot in heads_ holding the list of timers being fired
+static const int EXPIRING_SLOT = WHEEL_SLOTS;
+
+TimingWheel::TimingWheel(unsigned long long now_ms) {
+  current_ = now_ms;
+  count_ = 0;
+  free_list_ = -1;
+  for (unsigned int i = 0; i <= WHEEL_SLOTS; i++) {
+    heads_[i] = -1;
+  }
+  memset(occupied_, 0x00, sizeof(occupied_));
+}
+
+TimingWheel::~TimingWheel() {
+}
+
+TimerId TimingWheel::schedule(unsigned long long expire_ms, TimerCallback cb, void* arg) {
+  int index;
+  if (free_list_ != -1) {
+    index = free_list_;
+    free_list_ = nodes_[index].next;
+  } else {
+    index = nodes_.size();
+    TimerNode node;
+    memset(&node, 0x00, sizeof(node));
+    nodes_.push_back(node);
+  }
+
+  TimerNode& node = nodes_[index];
+  node.expire = expire_ms;
+  node.cb = cb;
+  node.arg = arg;
+  place(index);
+  count_++;
+
+  return ((TimerId)node.gen << 32) | (unsigned int)(index + 1);
+}
+
+bool TimingWheel::cancel(TimerId id) {
+  unsigned int index = (unsigned int)(id & 0xFFFFFFFF) - 1;
+  if (index >= nodes_.size())
+    return false;
+
+  TimerNode& node = nodes_[index];
+  if (node.slot < 0 || node.gen != (unsigned int)(id >> 32))
+    return false;
+
+  unlink(index);
+  free_node(index);
+  return true;
+}
+
+/**
+ * @brief Put a timer into the slot matching its distance from current_:
+ * level 0 if it is due within one turn of level 0, otherwise the lowest
+ * level whose turn covers it. Overdue timers fire on the next tick.
+ */
+void TimingWheel::place(int index) {
+  unsigned long long expire = nodes_[index].expire;
+  if (expire < current_)
+    expire = current_;
+
+  unsigned long long delta = expire - current_;
+  if (delta >= WHEEL_RANGE) {
+    expire = current_ + WHEEL_RANGE - 1;
+    delta = WHEEL_RANGE - 1;
+  }
+
+  int slot;
+  if (delta < WHEEL_L0_SIZE) {
+    slot = expire & (WHEEL_L0_SIZE - 1);
+  } else {
+    unsigned int level = 1;
+    while (delta >= (1ULL << (level_shift(level) + WHEEL_LN_BITS))) {
+      level++;
+    }
+    slot = level_base(level) + ((expire >> level_shift(level)) & (WHEEL_LN_SIZE - 1));
+  }
+
+  link(index, slot);
+}
+
+void TimingWheel::link(int index, int slot) {
+  TimerNode& node = nodes_[index];
+  node.slot = slot;
+  node.prev = -1;
+  node.next = heads_[slot];
+  if (node.next != -1)
+    nodes_[node.next].prev = index;
+  heads_[slot] = index;
+  if (slot != EXPIRING_SLOT)
+    occupied_[slot / 64] |= 1ULL << (slot % 64);
+}
+
+void TimingWheel::unlink(int index) {
+  TimerNode& node = nodes_[index];
+  if (node.prev != -1)
+    nodes_[node.prev].next = node.next;
+  else
+    heads_[node.slot] = node.next;
+  if (node.next != -1)
+    nodes_[node.next].prev = node.prev;
+
+  if (heads_[node.slot] == -1 && node.slot != EXPIRING_SLOT)
+    occupied_[node.slot / 64] &= ~(1ULL << (node.slot % 64));
+  node.slot = -1;
+}
+
+void TimingWheel::free_node(int index) {
+  TimerNode& node = nodes_[index];
+  node.slot = -1;
+  node.gen++;
+  node.next = free_list_;
+  free_list_ = index;
+  count_--;
+}
+
+/**
+ * @brief Re-insert the timers of the current slot of an upper level,
+ * they now fall into lower levels.
+ */
+void TimingWheel::cascade(unsigned int level) {
+  int slot = level_base(level) + ((current_ >> level_shift(level)) & (WHEEL_LN_SIZE - 1));
+  int index = heads_[slot];
+  heads_[slot] = -1;
+  occupied_[slot / 64] &= ~(1ULL << (slot % 64));
+
+  while (index != -1) {
+    int next = nodes_[index].next;
+    place(index);
+    index = next;
+  }
+}
+
+/**
+ * @brief First non-empty slot of a level at or after @a from, -1 if none.
+ */
+int TimingWheel::next_slot(unsigned int level, unsigned int from) const {
+  unsigned int size = (level == 0) ? WHEEL_L0_SIZE : WHEEL_LN_SIZE;
+  unsigned int base = level_base(level);
+
+  while (from < size) {
+    unsigned int pos = base + from;
+    unsigned long long bits = occupied_[pos / 64] >> (pos % 64);
+    if (bits != 0) {
+      unsigned int found = from + __builtin_ctzll(bits);
+      return (found < size) ? (int)found : -1;
+    }
+    from += 64 - (pos % 64);
+  }
+  return -1;
+}
+
+size_t TimingWheel::expire(unsigned long long now_ms) {
+  size_t fired = 0;
+
+  while (current_ <= now_ms) {
+    unsigned int index = current_ & (WHEEL_L0_SIZE - 1);
+
+    // Level 0 completed a turn: bring down the timers of the next
+    // slot of level 1, and so on up when that level completes a turn too
+    if (index == 0) {
+      for (unsigned int level = 1; level < WHEEL_LEVELS; level++) {
+        cascade(level);
+        if (((current_ >> level_shift(level)) & (WHEEL_LN_SIZE - 1)) != 0)
+          break;
+      }
+    }
+
+    // Move the due timers aside first, so that callbacks can schedule
+    // and cancel timers, including the ones about to fire
+    int node = heads_[index];
+    heads_[index] = -1;
+    occupied_[index / 64] &= ~(1ULL << (index % 64));
+    heads_[EXPIRING_SLOT] = node;
+    for (; node != -1; node = nodes_[node].next) {
+      nodes_[node].slot = EXPIRING_SLOT;
+    }
+    current_++;
+
+    while (heads_[EXPIRING_SLOT] != -1) {
+      int expired = heads_[EXPIRING_SLOT];
+      TimerCallback cb = nodes_[expired].cb;
+      void* arg = nodes_[expired].arg;
+      TimerId id = ((TimerId)nodes_[expired].gen << 32) | (unsigned int)(expired + 1);
+
+      unlink(expired);
+      free_node(expired);
+      cb(id, arg);
+      fired++;
+    }
 
-  if(timer_create(CLOCK_REALTIME, nullptr, &timer)) {
-    perror("timer_create");
+    // Jump over empty slots, up to the end of the current turn of level 0
+    index = current_ & (WHEEL_L0_SIZE - 1);
+    if (index != 0) {
+      int next = next_slot(0, index);
+      unsigned long long target = current_ - index + ((next < 0) ? WHEEL_L0_SIZE : next);
+      current_ = (target > now_ms + 1) ? now_ms + 1 : target;
+    }
+  }
+
+  return fired;
+}
+
+unsigned long long TimingWheel::next_expiry() const {
+  if (count_ == 0)
+    return ~0ULL;
+
+  // At the start of a turn of level 0, the slots expire() cascades first
+  // may hold timers due on this very turn
+  unsigned int index = current_ & (WHEEL_L0_SIZE - 1);
+  if (index == 0) {
+    for (unsigned int level = 1; level < WHEEL_LEVELS; level++) {
+      unsigned int pos = (current_ >> level_shift(level)) & (WHEEL_LN_SIZE - 1);
+      unsigned int slot = level_base(level) + pos;
+      if (occupied_[slot / 64] & (1ULL << (slot % 64)))
+        return current_;
+      if (pos != 0)
+        break;
+    }
   }
-  timer_id_ = timer;
+
+  // Beyond the non-empty slots of level 0, the next cascade may bring
+  // timers due earlier than the ones of the next turn
+  int next = next_slot(0, index);
+  return current_ - index + ((next < 0) ? WHEEL_L0_SIZE : next);
+}
+
+TimerList::TimerList() : wheel_(monotonic_ms()) {
+  handler_ = nullptr;
 }
 
 TimerList::~TimerList() {
-  timer_delete(timer_id_);
 }
 
 TimerList* TimerList::get_instance() {
@@ -31,55 +271,44 @@ bool TimerList::register_handler(TimerHandler handler) {
   return true;
 }
 
-bool TimerList::add(int fired_time /* in milisecond */, TimerType type) {
-  if(firedTime < MIN_EXPIRE_TIME_MS) {
-    return false;
+/**
+ * @brief Start a timer. Return its handle for remove(), 0 on failure.
+ */
+TimerId TimerList::add(int fired_time /* in milisecond */, TimerType type) {
+  if(fired_time < (int)MIN_EXPIRE_TIME_MS) {
+    return 0;
   }
 
-  struct SingleTimer timer;
-  timer.remain_time = fired_time;
-  timer.type = type;
-  list_.push_back(timer);
-  return true;
+  return wheel_.schedule(monotonic_ms() + fired_time, listener, (void*)(intptr_t)type);
 }
 
-void TimerList::remove(int index) {
-
+/**
+ * @brief Cancel a timer. Return false if it already fired.
+ */
+bool TimerList::remove(TimerId id) {
+  return wheel_.cancel(id);
 }
 
-void TimerList::listener(int signo) {
+void TimerList::listener(TimerId id, void* arg) {
   TimerList* myself = TimerList::get_instance();
-  list<SingleTimer>* temp_list = &(myself->list_);
-  list<SingleTimer>::iterator iter;
-  
-  if(temp_list->size() == 0) {
-    return;
-  }
-
-  for(iter = temp_list->begin(); iter != temp_list->end(); iter++) {
-    iter->remain_time = iter->remain_time - COMMON_STEP;
-    if(iter->remain_time <= 0) {
-      myself->handler_(iter->type);
-      //remove element has mRemainTime <= 0
-      iter = temp_list->erase(iter);
-    }
+  if(myself->handler_ != nullptr) {
+    myself->handler_((TimerType)(intptr_t)arg);
   }
 }
 
+/**
+ * @brief Sleep until the next timer is due and fire it, until no timer is left.
+ */
 void TimerList::run() {
-  struct itimerspec ts;
-  ts.it_interval.tv_sec = INTERVAL_TV_SEC;
-  ts.it_interval.tv_nsec = INTERVAL_TV_NSEC; /*COMMON_STEP * 1000000; //Timer fire each 0.25 second.*/
-  ts.it_value.tv_sec = INITIAL_TV_SEC;  //current fire time is 5s
-  ts.it_value.tv_nsec = INITIAL_TV_NSEC;
-
-  signal(SIGALRM, listener);
-  if(timer_settime(timer_id_, 0, &ts, NULL)) {
-    perror("timer_settime");
-    return;
-  }
-
-  while(list_.size() != 0) {
-    pause();
+  while(wheel_.size() != 0) {
+    unsigned long long now = monotonic_ms();
+    unsigned long long next = wheel_.next_expiry();
+    if(next > now) {
+      struct timespec ts;
+      ts.tv_sec = (next - now) / 1000;
+      ts.tv_nsec = ((next - now) % 1000) * 1000000;
+      nanosleep(&ts, nullptr);
+    }
+    wheel_.expire(monotonic_ms());
   }
 }
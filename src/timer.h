@@ -1,6 +1,7 @@
 /**
- *  Simulate multiple timers using advanced Posix timer. This class 
- *  is intended to use for SIP timers.
+ *  Timers kept in a hierarchical timing wheel with millisecond resolution.
+ *  TimerList uses it to simulate multiple timers, it is intended to use
+ *  for SIP timers.
  */
 #ifndef TIMER_H_
 #define TIMER_H_
@@ -8,18 +9,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <list>
+#include <vector>
 #include <string.h>
 #include <time.h>
 #include <signal.h>
 #include <sys/types.h>
 
 const unsigned int MIN_EXPIRE_TIME_MS = 500; //minimum input expiration time
-const unsigned int COMMON_STEP = 250; //each 250 ms, posix timer will fires
-const unsigned int INITIAL_TV_SEC = 1;
-const unsigned int INITIAL_TV_NSEC = 0;
-const unsigned int INTERVAL_TV_SEC = 0;
-const unsigned int INTERVAL_TV_NSEC = COMMON_STEP * 1000000;
+
+// Layout of the timing wheel: level 0 has one slot per millisecond,
+// each slot of level n covers a whole turn of level n-1.
+const unsigned int WHEEL_LEVELS = 4;
+const unsigned int WHEEL_L0_BITS = 8;  //256 slots of 1ms
+const unsigned int WHEEL_LN_BITS = 6;  //64 slots per upper level
+const unsigned int WHEEL_L0_SIZE = 1 << WHEEL_L0_BITS;
+const unsigned int WHEEL_LN_SIZE = 1 << WHEEL_LN_BITS;
+const unsigned int WHEEL_SLOTS = WHEEL_L0_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LN_SIZE;
+//timers further away than this (about 18.6 hours) wait in the last slot
+//of the top level and are re-inserted until they are in range
+const unsigned long long WHEEL_RANGE = 1ULL << (WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS);
 
 using namespace std;
 typedef enum TimerType {
@@ -38,13 +46,91 @@ typedef enum TimerType {
                         TimerType_Sip_K     //T4 for UDP | 0 second for TCP, SCTP
 } TimerType;
 
-typedef struct SingleTimer {
-  int remain_time; /* in millisecond */
-  TimerType type;
-} SingleTimer;
+//Handle of a scheduled timer, 0 is never a valid handle
+typedef unsigned long long TimerId;
+
+typedef void (*TimerCallback) (TimerId id, void* arg);
 
 typedef void (*TimerHandler) (TimerType type);
 
+//Current time of CLOCK_MONOTONIC in milliseconds
+unsigned long long monotonic_ms();
+
+/**
+ * @class TimingWheel
+ *
+ * @brief Hierarchical timing wheel. Scheduling and cancelling are O(1),
+ * expiry is amortized O(1) per timer: a timer is moved down at most
+ * WHEEL_LEVELS - 1 times before it fires. Timers live in a pool and are
+ * linked by index, handles carry a generation so that cancelling a timer
+ * which already fired is detected.
+ */
+class TimingWheel {
+public:
+  TimingWheel(unsigned long long now_ms=0);
+  ~TimingWheel();
+
+  /**
+   * @brief Call @a cb with @a arg once time reaches @a expire_ms.
+   */
+  TimerId schedule(unsigned long long expire_ms, TimerCallback cb, void* arg);
+
+  /**
+   * @brief Return false if the timer already fired or was cancelled.
+   */
+  bool cancel(TimerId id);
+
+  /**
+   * @brief Advance the wheel to @a now_ms, firing all timers due by then.
+   * Callbacks may schedule and cancel timers. Return the number fired.
+   */
+  size_t expire(unsigned long long now_ms);
+
+  /**
+   * @brief Earliest time at which expire() may have something to do, never
+   * later than the earliest deadline. ~0ULL if no timer is scheduled.
+   */
+  unsigned long long next_expiry() const;
+
+  size_t size() const {
+    return count_;
+  }
+
+private:
+  struct TimerNode {
+    unsigned long long expire;
+    TimerCallback cb;
+    void* arg;
+    int prev;
+    int next;
+    int slot; // Slot holding the timer, -1 when the node is free
+    unsigned int gen;
+  };
+
+  void place(int index);
+  void link(int index, int slot);
+  void unlink(int index);
+  void free_node(int index);
+  void cascade(unsigned int level);
+  int next_slot(unsigned int level, unsigned int from) const;
+
+private:
+  unsigned long long current_; // Next tick to be processed
+  size_t count_;
+  vector<TimerNode> nodes_;
+  int free_list_;
+  int heads_[WHEEL_SLOTS + 1]; // Last one holds the timers being fired
+  // One bit per non-empty slot, to skip over empty ones
+  unsigned long long occupied_[WHEEL_SLOTS / 64];
+};
+
+/**
+ * @class TimerList
+ *
+ * @brief SIP timers identified by their type, fired through one handler.
+ * run() blocks the calling thread; inside a reactor loop use
+ * Reactor::schedule_timer() instead.
+ */
 class TimerList {
 private:
   TimerList();
@@ -53,15 +139,16 @@ private:
 public:
   static TimerList* get_instance();
   bool register_handler(TimerHandler handler);
-  static void listener(int signo);
-  bool add(int firedTime, TimerType type);
-  void remove(int index);
+  TimerId add(int fired_time, TimerType type);
+  bool remove(TimerId id);
   void run();
 
+private:
+  static void listener(TimerId id, void* arg);
+
 private:
   static TimerList* instance_;
-  list<SingleTimer> list_;
-  timer_t timer_id_;
+  TimingWheel wheel_;
   TimerHandler handler_;
 };
 
@@ -1,50 +1,417 @@
 #include "udp_handler.h"
+#include "sip_scan.h"
 
-UdpHandler::UdpHandler(const InetAddr& addr, Reactor* reactor) {
-  sock_dgram_ = new SockDatagram(addr);
+UdpHandler::UdpHandler(const InetAddr& addr, Reactor* reactor, bool reuse_port) {
+  const ReactorConfig& config = reactor->get_config();
+  // Connected sockets are bound to the same address as this one
+  if (config.udp_connect_threshold > 0)
+    reuse_port = true;
+
+  sock_dgram_ = new SockDatagram(addr, reuse_port);
   reactor_ = reactor;
+  parent_ = nullptr;
+  serial_ = reactor->next_serial();
+  truncated_ = 0;
+  send_dropped_ = 0;
+  out_head_ = 0;
+  if (reactor->is_edge_triggered())
+    set_nonblocking(sock_dgram_->get_handle());
+
+  if (config.udp_connect_threshold > 0)
+    talkers_.resize(UDP_TALKER_SLOTS);
+  init_batch(config.udp_recv_batch);
+
+  if (reactor->get_dgram_sender() == nullptr)
+    reactor->set_dgram_sender(this);
+  reactor->set_dgram(sock_dgram_->get_handle(), this);
+
+  interest_ = READ_EVENT;
   reactor->register_handler(this, READ_EVENT);
 }
 
+UdpHandler::UdpHandler(UdpHandler* parent, Socket handle) {
+  sock_dgram_ = new SockDatagram(handle);
+  reactor_ = parent->reactor_;
+  parent_ = parent;
+  serial_ = 0;
+  truncated_ = 0;
+  send_dropped_ = 0;
+  out_head_ = 0;
+  if (reactor_->is_edge_triggered())
+    set_nonblocking(handle);
+
+  // A single peer rarely fills a large batch
+  unsigned int batch_size = reactor_->get_config().udp_recv_batch;
+  init_batch(batch_size < 8 ? batch_size : 8);
+
+  interest_ = READ_EVENT;
+  reactor_->register_handler(this, READ_EVENT);
+}
+
 UdpHandler::~UdpHandler() {
+  std::unordered_map<unsigned long long, UdpHandler*>::iterator it;
+  for (it = connected_.begin(); it != connected_.end(); ++it) {
+    delete it->second;
+  }
+
+  reactor_->cancel_flush(this);
+  if (reactor_->get_dgram_sender() == this)
+    reactor_->set_dgram_sender(nullptr);
+  if (parent_ == nullptr)
+    reactor_->set_dgram(get_handle(), nullptr);
+
   // Removing handler need to get socket descriptor from mSockDgram,
   // so we must delete mSockDgram after calling mRemoveHandler.
-  reactor_->remove_handler(this, READ_EVENT);
+  reactor_->remove_handler(this, interest_);
   delete sock_dgram_;
 }
 
+/**
+ * @brief Allocate the recvmmsg() slots once, they are reused by every call.
+ */
+void UdpHandler::init_batch(unsigned int batch_size) {
+#if defined (HAS_RECVMMSG)
+  batch_size_ = batch_size;
+  if (batch_size_ == 0)
+    batch_size_ = 1;
+  if (batch_size_ > UDP_RECV_BATCH_MAX)
+    batch_size_ = UDP_RECV_BATCH_MAX;
+
+  buffers_.resize(batch_size_ * SIP_UDP_MSG_MAX_SIZE);
+  msgs_.resize(batch_size_);
+  iovs_.resize(batch_size_);
+  peers_.resize(batch_size_);
+  batch_.resize(batch_size_);
+  for (unsigned int i = 0; i < batch_size_; i++) {
+    iovs_[i].iov_base = &buffers_[i * SIP_UDP_MSG_MAX_SIZE];
+    iovs_[i].iov_len = SIP_UDP_MSG_MAX_SIZE;
+    memset(&msgs_[i], 0x00, sizeof(msgs_[i]));
+    msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+    msgs_[i].msg_hdr.msg_iovlen = 1;
+    msgs_[i].msg_hdr.msg_name = &peers_[i];
+  }
+#endif // HAS_RECVMMSG
+}
+
 void UdpHandler::handle_event(Socket sockfd, EventType et) {
-  if ((et & READ_EVENT) == READ_EVENT) {
+  if ((et & READ_EVENT) == READ_EVENT)
     handle_read(sockfd);
-  } else if ((et & WRITE_EVENT) == WRITE_EVENT) {
+  if ((et & WRITE_EVENT) == WRITE_EVENT)
     handle_write(sockfd);
-  } else if ((et & EXCEPT_EVENT) == EXCEPT_EVENT) {
+  if ((et & (EXCEPT_EVENT | CLOSE_EVENT)) != 0)
     handle_except(sockfd);
-  }
 }
 
+#if defined (HAS_RECVMMSG)
+/**
+ * @brief Read a batch of datagrams with one recvmmsg(). MSG_DONTWAIT keeps
+ * it from waiting for a full batch on a blocking socket.
+ */
+void UdpHandler::handle_read(Socket sockfd) {
+  bool drain = reactor_->is_edge_triggered();
+  int n;
+
+  do {
+    for (unsigned int i = 0; i < batch_size_; i++) {
+      msgs_[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    n = recvmmsg(sockfd, &msgs_[0], batch_size_, MSG_DONTWAIT, nullptr);
+    ReactorStats& stats = reactor_->stats();
+    stats.sys_read++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < n; i++) {
+      if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        truncated_++;
+        stats.truncations++;
+        continue;
+      }
+      stats.messages_in++;
+      stats.bytes_in += msgs_[i].msg_len;
+      batch_[count].peer = peers_[i];
+      batch_[count].data = (char*) iovs_[i].iov_base;
+      batch_[count].len = trim(batch_[count].data, msgs_[i].msg_len);
+      count++;
+    }
+
+    // Replies sent from the callbacks go out through this socket
+    UdpHandler* owner = (parent_ != nullptr) ? parent_ : this;
+    reactor_->set_dgram_sender(owner);
+    // Worker threads get datagrams one by one
+    if (reactor_->udp_batch_handler_ != nullptr && reactor_->get_worker_pool() == nullptr) {
+      if (count > 0)
+        reactor_->udp_batch_handler_(&batch_[0], count);
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        reactor_->deliver_dgram(owner->get_handle(), owner->serial_, batch_[i].peer,
+                                batch_[i].data, batch_[i].len);
+      }
+    }
+  } while (drain && n == (int)batch_size_);
+}
+#else
 void UdpHandler::handle_read(Socket sockfd) {
   char buff[SIP_UDP_MSG_MAX_SIZE];
   ssize_t n;
   struct sockaddr_in cliaddr;
-  socklen_t clilen = sizeof(cliaddr);
+  socklen_t clilen;
+  bool drain = reactor_->is_edge_triggered();
 
-  n = sock_dgram_->recv_from(buff, sizeof(buff), 0, (struct sockaddr*)&cliaddr, &clilen);
-  if(n < 0){
-    return;
-  }
+  do {
+    clilen = sizeof(cliaddr);
+    // With MSG_TRUNC the real length of a datagram larger than buff is returned
+    n = sock_dgram_->recv_from(buff, sizeof(buff), MSG_TRUNC, (struct sockaddr*)&cliaddr, &clilen);
+    reactor_->stats().sys_read++;
+    if(n < 0){
+      if (errno == EINTR)
+        continue;
+      return;
+    }
 
-  // Check whether end-of-message reach or not. If not reach, may be message is larger than
-  // 3kB. We send error response in this case. If reach end of msg, transfer to user's callback
-  reactor_->udp_read_handler_(cliaddr, buff, n);
+    if ((size_t)n > sizeof(buff)) {
+      truncated_++;
+      reactor_->stats().truncations++;
+      continue;
+    }
+    deliver(cliaddr, buff, n);
+  } while (drain);
 }
+#endif // HAS_RECVMMSG
 
+/**
+ * @brief The socket buffer has room again after sendmmsg() failed with
+ * EAGAIN, retry the queued datagrams.
+ */
 void UdpHandler::handle_write(Socket sockfd) {
-  // Ignore this method because we only register READ_EVENT to Reactor.
+  handle_flush();
 }
 
+/**
+ * @brief A datagram socket is never closed by its peer, an error event
+ * only reports a pending socket error. Fetching it clears it.
+ */
 void UdpHandler::handle_except(Socket sockfd) {
-  // Ignore this method because we only register READ_EVENT to Reactor.
+  int error;
+  socklen_t len = sizeof(error);
+  getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len);
+}
+
+/**
+ * @brief Datagram already received by a completion-based demultiplexer.
+ */
+void UdpHandler::handle_input(Socket sockfd, char* data, size_t len,
+                              struct sockaddr_in* peer) {
+  deliver(*peer, data, len);
+}
+
+/**
+ * @brief Datagram dropped by a completion-based demultiplexer.
+ */
+void UdpHandler::handle_truncated(Socket sockfd) {
+  truncated_++;
+}
+
+/**
+ * @brief Pass a datagram to the user callback.
+ */
+void UdpHandler::deliver(const struct sockaddr_in& peer, char* data, size_t len) {
+  reactor_->stats().messages_in++;
+  reactor_->stats().bytes_in += len;
+  len = trim(data, len);
+  UdpHandler* owner = (parent_ != nullptr) ? parent_ : this;
+  reactor_->set_dgram_sender(owner);
+  if (reactor_->udp_batch_handler_ != nullptr && reactor_->get_worker_pool() == nullptr) {
+    DgramMessage message;
+    message.peer = peer;
+    message.data = data;
+    message.len = len;
+    reactor_->udp_batch_handler_(&message, 1);
+  } else {
+    reactor_->deliver_dgram(owner->get_handle(), owner->serial_, peer, data, len);
+  }
+}
+
+/**
+ * @brief Length of the SIP message in a datagram. As required by RFC 3261
+ * section 18.3, bytes beyond Content-Length are dropped.
+ */
+size_t UdpHandler::trim(const char* data, size_t len) const {
+  const char* headers_end = sip_find_header_end(data, data + len);
+  if (headers_end != nullptr) {
+    long body_len = sip_content_length(data, headers_end + 2);
+    size_t headers_len = headers_end + 4 - data;
+    if (body_len >= 0 && headers_len + body_len < len)
+      return headers_len + body_len;
+  }
+  return len;
+}
+
+bool UdpHandler::send(const struct sockaddr_in& peer, const char* data, size_t len) {
+  UdpHandler* target = this;
+  if (!talkers_.empty()) {
+    UdpHandler* connected = connected_handler(peer);
+    if (connected != nullptr)
+      target = connected;
+  }
+
+  if (target->out_queue_.size() - target->out_head_ >= UDP_SEND_QUEUE_MAX) {
+    send_dropped_++;
+    reactor_->stats().drops++;
+    return false;
+  }
+  target->enqueue(peer, data, len);
+  return true;
+}
+
+void UdpHandler::enqueue(const struct sockaddr_in& peer, const char* data, size_t len) {
+  // The first datagram queued asks for a flush, unless the socket is
+  // already waiting to become writable
+  if (out_head_ == out_queue_.size() && (interest_ & WRITE_EVENT) == 0)
+    reactor_->defer_flush(this);
+
+  OutDgram dgram;
+  dgram.peer = peer;
+  dgram.offset = out_data_.size();
+  dgram.len = len;
+  out_data_.insert(out_data_.end(), data, data + len);
+  out_queue_.push_back(dgram);
+}
+
+/**
+ * @brief Connected socket for @a peer, created once the number of datagrams
+ * sent to it within a second reaches ReactorConfig::udp_connect_threshold.
+ * Return nullptr while it is below.
+ */
+UdpHandler* UdpHandler::connected_handler(const struct sockaddr_in& peer) {
+  unsigned long long key = ((unsigned long long) peer.sin_addr.s_addr << 16) | peer.sin_port;
+  std::unordered_map<unsigned long long, UdpHandler*>::iterator it = connected_.find(key);
+  if (it != connected_.end())
+    return it->second;
+
+  const ReactorConfig& config = reactor_->get_config();
+  unsigned long long second = reactor_->now() / 1000;
+  // Peers sharing a slot only delay each other's connected socket
+  TalkerCount& talker = talkers_[((key * 0x9E3779B97F4A7C15ULL) >> 32) & (UDP_TALKER_SLOTS - 1)];
+  if (talker.key != key || talker.second != second) {
+    talker.key = key;
+    talker.second = second;
+    talker.count = 0;
+  }
+  if (++talker.count < config.udp_connect_threshold || connected_.size() >= config.udp_connected_max)
+    return nullptr;
+
+  struct sockaddr_in local;
+  socklen_t len = sizeof(local);
+  if (getsockname(get_handle(), (struct sockaddr*) &local, &len) < 0) {
+    perror("getsockname");
+    return nullptr;
+  }
+
+  Socket handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (handle < 0) {
+    perror("socket");
+    return nullptr;
+  }
+  set_reuse_port(handle);
+  if (bind(handle, (struct sockaddr*) &local, sizeof(local)) < 0 ||
+      connect(handle, (const struct sockaddr*) &peer, sizeof(peer)) < 0) {
+    perror("connected UDP socket");
+    close(handle);
+    // Do not retry for every datagram of this second
+    talker.count = 0;
+    return nullptr;
+  }
+
+  UdpHandler* handler = new UdpHandler(this, handle);
+  connected_[key] = handler;
+  return handler;
+}
+
+/**
+ * @brief Write the queue, UDP_SEND_BATCH datagrams per sendmmsg(). On
+ * EAGAIN the rest waits for WRITE_EVENT.
+ */
+void UdpHandler::handle_flush() {
+  UdpHandler* root = (parent_ != nullptr) ? parent_ : this;
+  Socket handle = get_handle();
+
+  while (out_head_ < out_queue_.size()) {
+#if defined (HAS_SENDMMSG)
+    unsigned int count = out_queue_.size() - out_head_;
+    if (count > UDP_SEND_BATCH)
+      count = UDP_SEND_BATCH;
+
+    for (unsigned int i = 0; i < count; i++) {
+      OutDgram& dgram = out_queue_[out_head_ + i];
+      out_iovs_[i].iov_base = out_data_.data() + dgram.offset;
+      out_iovs_[i].iov_len = dgram.len;
+      memset(&out_msgs_[i], 0x00, sizeof(out_msgs_[i]));
+      out_msgs_[i].msg_hdr.msg_iov = &out_iovs_[i];
+      out_msgs_[i].msg_hdr.msg_iovlen = 1;
+      // A connected socket has its destination already
+      if (parent_ == nullptr) {
+        out_msgs_[i].msg_hdr.msg_name = &dgram.peer;
+        out_msgs_[i].msg_hdr.msg_namelen = sizeof(dgram.peer);
+      }
+    }
+
+    int n = sendmmsg(handle, out_msgs_, count, MSG_DONTWAIT);
+#else
+    OutDgram& dgram = out_queue_[out_head_];
+    struct sockaddr* to = nullptr;
+    socklen_t to_len = 0;
+    if (parent_ == nullptr) {
+      to = (struct sockaddr*) &dgram.peer;
+      to_len = sizeof(dgram.peer);
+    }
+    int n = 1;
+    if (sock_dgram_->send_to(out_data_.data() + dgram.offset, dgram.len, MSG_DONTWAIT, to, to_len) < 0)
+      n = -1;
+#endif // HAS_SENDMMSG
+
+    ReactorStats& stats = reactor_->stats();
+    stats.sys_write++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if ((interest_ & WRITE_EVENT) == 0)
+          set_interest(READ_EVENT | WRITE_EVENT);
+        return;
+      }
+      // The first datagram of the batch is refused, skip it
+      root->send_dropped_++;
+      stats.drops++;
+      out_head_++;
+      continue;
+    }
+    stats.messages_out += n;
+    for (int i = 0; i < n; i++) {
+      stats.bytes_out += out_queue_[out_head_ + i].len;
+    }
+    out_head_ += n;
+  }
+
+  out_queue_.clear();
+  out_data_.clear();
+  out_head_ = 0;
+  if ((interest_ & WRITE_EVENT) != 0)
+    set_interest(READ_EVENT);
+}
+
+void UdpHandler::set_interest(EventType et) {
+  reactor_->modify_interest(this, et);
+  interest_ = et;
+}
+
+bool UdpHandler::is_completion_aware() const {
+  return true;
 }
 
 Socket UdpHandler::get_handle() const {
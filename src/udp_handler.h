@@ -1,6 +1,9 @@
 #ifndef UDP_HANDLER_H_
 #define UDP_HANDLER_H_
 
+#include <unordered_map>
+#include <vector>
+
 #include "common.h"
 #include "event_handler.h"
 #include "socket_wf.h"
@@ -9,25 +12,126 @@
 /**
  * @class UdpHandler
  *
- * @brief Handle data from UDP clients.
+ * @brief Handle data from UDP clients. Where recvmmsg() is available,
+ * up to ReactorConfig::udp_recv_batch datagrams are read per system call
+ * into buffers allocated once.
+ *
+ * Outgoing datagrams are queued by send() and written with sendmmsg() at
+ * the end of the loop iteration. Peers receiving more than
+ * ReactorConfig::udp_connect_threshold datagrams per second can get a
+ * socket of their own, bound to the same address and connected to them,
+ * which spares the kernel a route lookup per datagram.
  */
 class UdpHandler : public EventHandler {
 public: 
-  UdpHandler(const InetAddr& addr, Reactor* reactor);
+  UdpHandler(const InetAddr& addr, Reactor* reactor, bool reuse_port=false);
   ~UdpHandler();
   
   virtual void handle_event(Socket sockfd, EventType et);
   virtual Socket get_handle() const;
 
+  virtual bool is_completion_aware() const;
+  virtual void handle_input(Socket sockfd, char* data, size_t len,
+                            struct sockaddr_in* peer);
+  virtual void handle_truncated(Socket sockfd);
+
+  /**
+   * @brief Queue a datagram, it is sent once the current loop iteration
+   * is over. Return false if the queue is full.
+   */
+  bool send(const struct sockaddr_in& peer, const char* data, size_t len);
+
+  /**
+   * @brief Write the queued datagrams. Called by the Reactor.
+   */
+  virtual void handle_flush();
+
+  /**
+   * @brief Number of datagrams dropped because they did not fit in
+   * SIP_UDP_MSG_MAX_SIZE, or in a provided buffer with io_uring.
+   */
+  unsigned long truncated_count() const {
+    return truncated_;
+  }
+
+  /**
+   * @brief Number of outgoing datagrams dropped, because the queue was
+   * full or the kernel refused them.
+   */
+  unsigned long send_dropped_count() const {
+    return send_dropped_;
+  }
+
+  /**
+   * @brief See Reactor::next_serial(), 0 for a connected socket.
+   */
+  unsigned long long serial() const {
+    return serial_;
+  }
+
 protected:
   virtual void handle_read(Socket sockfd);
   virtual void handle_write(Socket sockfd);
   virtual void handle_except(Socket sockfd);
 
+private:
+  // Socket connected to a single peer, sharing the address of its parent
+  UdpHandler(UdpHandler* parent, Socket handle);
+
+  void init_batch(unsigned int batch_size);
+  void deliver(const struct sockaddr_in& peer, char* data, size_t len);
+  size_t trim(const char* data, size_t len) const;
+  void enqueue(const struct sockaddr_in& peer, const char* data, size_t len);
+  UdpHandler* connected_handler(const struct sockaddr_in& peer);
+  void set_interest(EventType et);
+
+  struct OutDgram {
+    struct sockaddr_in peer;
+    size_t offset; // In out_data_
+    size_t len;
+  };
+
+  // Datagrams recently sent to a peer, for the connected socket mode
+  struct TalkerCount {
+    unsigned long long key;
+    unsigned long long second;
+    unsigned int count;
+  };
+
 private:
   SockDatagram* sock_dgram_;
   
   Reactor* reactor_;
+
+  // Handler owning this connected socket, nullptr for a listening one
+  UdpHandler* parent_;
+  unsigned long long serial_;
+  EventType interest_;
+
+  unsigned long truncated_;
+  unsigned long send_dropped_;
+
+  std::vector<OutDgram> out_queue_;
+  size_t out_head_; // First datagram not sent yet
+  std::vector<char> out_data_;
+
+  std::vector<TalkerCount> talkers_;
+  std::unordered_map<unsigned long long, UdpHandler*> connected_;
+
+#if defined (HAS_RECVMMSG)
+  //One slot per datagram of a batch
+  unsigned int batch_size_;
+  std::vector<char> buffers_;
+  std::vector<struct mmsghdr> msgs_;
+  std::vector<struct iovec> iovs_;
+  std::vector<struct sockaddr_in> peers_;
+  std::vector<DgramMessage> batch_;
+#endif // HAS_RECVMMSG
+
+#if defined (HAS_SENDMMSG)
+  struct mmsghdr out_msgs_[UDP_SEND_BATCH];
+  struct iovec out_iovs_[UDP_SEND_BATCH];
+#endif // HAS_SENDMMSG
 };
 
 #endif // UDP_HANDLER_H_
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "worker_pool.h"
+#include "reactor.h"
+#include "tcp_handler.h"
+#include "udp_handler.h"
+
+thread_local const WorkerPool::Item* WorkerPool::current_ = nullptr;
+
+WorkerPool::WorkerPool(unsigned int nthreads) {
+  if (nthreads == 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpus > 0) ? ncpus : 1;
+  }
+  nthreads_ = nthreads;
+  for (size_t i = 0; i < WORKER_MAX_REACTORS; i++) {
+    producers_[i].used = false;
+    producers_[i].backlog = 0;
+  }
+  nproducers_.store(0, std::memory_order_relaxed);
+  stopping_.store(false, std::memory_order_relaxed);
+
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    Worker* worker = new Worker();
+    worker->sleeping.store(false, std::memory_order_relaxed);
+    workers_.push_back(worker);
+  }
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    workers_[i]->thread = std::thread(&WorkerPool::run, this, i);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  stopping_.store(true);
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    wake(workers_[i]);
+    workers_[i]->thread.join();
+  }
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    delete workers_[i];
+  }
+  for (size_t i = 0; i < WORKER_MAX_REACTORS; i++) {
+    for (size_t j = 0; j < producers_[i].rings.size(); j++) {
+      delete producers_[i].rings[j];
+    }
+    for (size_t j = 0; j < producers_[i].backlogs.size(); j++) {
+      for (size_t k = 0; k < producers_[i].backlogs[j].size(); k++) {
+        free(producers_[i].backlogs[j][k].data);
+      }
+    }
+  }
+}
+
+int WorkerPool::attach(Reactor* reactor) {
+  std::lock_guard<std::mutex> lock(attach_mutex_);
+  unsigned int count = nproducers_.load(std::memory_order_relaxed);
+  for (unsigned int slot = 0; slot < WORKER_MAX_REACTORS; slot++) {
+    Producer& producer = producers_[slot];
+    if (producer.used)
+      continue;
+
+    producer.used = true;
+    if (producer.rings.empty()) {
+      for (unsigned int i = 0; i < nthreads_; i++) {
+        Ring* ring = new Ring();
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        producer.rings.push_back(ring);
+      }
+      producer.backlogs.resize(nthreads_);
+    }
+    // Workers see the rings once they see the new count
+    if (slot >= count)
+      nproducers_.store(slot + 1, std::memory_order_release);
+    return slot;
+  }
+  return -1;
+}
+
+void WorkerPool::detach(int slot) {
+  std::lock_guard<std::mutex> lock(attach_mutex_);
+  producers_[slot].used = false;
+}
+
+bool WorkerPool::idle(int slot) const {
+  const Producer& producer = producers_[slot];
+  if (producer.backlog > 0)
+    return false;
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    Ring* ring = producer.rings[i];
+    if (ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed))
+      return false;
+  }
+  return true;
+}
+
+void WorkerPool::dispatch_stream(int slot, Reactor* reactor, Socket h,
+                                 unsigned long long serial, const char* data, size_t len) {
+  Item item;
+  item.reactor = reactor;
+  item.stream = true;
+  item.handle = h;
+  item.serial = serial;
+  memset(&item.peer, 0x00, sizeof(item.peer));
+  item.data = (char*) malloc(len);
+  if (item.data == nullptr) {
+    reactor->stats().drops++;
+    return;
+  }
+  memcpy(item.data, data, len);
+  item.len = len;
+  push(slot, (size_t) h * 0x9E3779B97F4A7C15ULL, item);
+}
+
+void WorkerPool::dispatch_dgram(int slot, Reactor* reactor, Socket h, unsigned long long serial,
+                                const struct sockaddr_in& peer, const char* data, size_t len) {
+  Item item;
+  item.reactor = reactor;
+  item.stream = false;
+  item.handle = h;
+  item.serial = serial;
+  item.peer = peer;
+  item.data = (char*) malloc(len);
+  if (item.data == nullptr) {
+    reactor->stats().drops++;
+    return;
+  }
+  memcpy(item.data, data, len);
+  item.len = len;
+  size_t key = ((size_t) peer.sin_addr.s_addr << 16) | peer.sin_port;
+  push(slot, key * 0x9E3779B97F4A7C15ULL, item);
+}
+
+/**
+ * @brief Append to @a ring, return false if it is full.
+ */
+bool WorkerPool::put(Ring* ring, const Item& item) {
+  size_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail - ring->head.load(std::memory_order_acquire) == WORKER_QUEUE_SIZE)
+    return false;
+
+  ring->items[tail & (WORKER_QUEUE_SIZE - 1)] = item;
+  ring->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+void WorkerPool::push(int slot, size_t hash, const Item& item) {
+  // The high bits of a multiplicative hash are the well mixed ones
+  unsigned int index = (unsigned int)((hash >> 32) % nthreads_);
+  Producer& producer = producers_[slot];
+  Worker* worker = workers_[index];
+
+  // Waiting for the worker here could deadlock with a worker waiting
+  // for the Reactor to run its replies, so the message is set aside.
+  // Once there is a backlog, later messages queue behind it
+  std::deque<Item>& backlog = producer.backlogs[index];
+  if (!backlog.empty() || !put(producer.rings[index], item)) {
+    backlog.push_back(item);
+    producer.backlog++;
+  }
+
+  // Pairs with the fence of a worker going to sleep: either it sees
+  // the new tail, or this sees it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (worker->sleeping.load(std::memory_order_relaxed))
+    wake(worker);
+}
+
+bool WorkerPool::flush(int slot) {
+  Producer& producer = producers_[slot];
+  if (producer.backlog == 0)
+    return false;
+
+  for (unsigned int i = 0; i < nthreads_; i++) {
+    std::deque<Item>& backlog = producer.backlogs[i];
+    size_t moved = 0;
+    while (!backlog.empty() && put(producer.rings[i], backlog.front())) {
+      backlog.pop_front();
+      moved++;
+    }
+    producer.backlog -= moved;
+
+    if (moved > 0) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (workers_[i]->sleeping.load(std::memory_order_relaxed))
+        wake(workers_[i]);
+    }
+  }
+  return producer.backlog > 0;
+}
+
+void WorkerPool::wake(Worker* worker) {
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  worker->sleeping.store(false, std::memory_order_relaxed);
+  worker->cond.notify_one();
+}
+
+bool WorkerPool::has_work(unsigned int index) const {
+  unsigned int count = nproducers_.load(std::memory_order_acquire);
+  for (unsigned int p = 0; p < count; p++) {
+    Ring* ring = producers_[p].rings[index];
+    if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_acquire))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Body of a worker: take up to WORKER_BATCH messages from each
+ * ring in turn, so that a busy Reactor does not starve the others, and
+ * sleep once all of them are empty.
+ */
+void WorkerPool::run(unsigned int index) {
+  Worker* worker = workers_[index];
+
+  for (;;) {
+    bool busy = false;
+    unsigned int count = nproducers_.load(std::memory_order_acquire);
+    for (unsigned int p = 0; p < count; p++) {
+      Ring* ring = producers_[p].rings[index];
+      size_t head = ring->head.load(std::memory_order_relaxed);
+      size_t tail = ring->tail.load(std::memory_order_acquire);
+
+      for (unsigned int n = 0; head != tail && n < WORKER_BATCH; n++) {
+        Item& item = ring->items[head & (WORKER_QUEUE_SIZE - 1)];
+        current_ = &item;
+        if (item.stream)
+          item.reactor->tcp_read_handler_(item.handle, item.data, item.len);
+        else
+          item.reactor->udp_read_handler_(item.peer, item.data, item.len);
+        current_ = nullptr;
+        free(item.data);
+
+        // The slot is only given back once the message is handled, so
+        // idle() tells when the Reactor is no longer referenced
+        ring->head.store(++head, std::memory_order_release);
+        busy = true;
+      }
+    }
+    if (busy)
+      continue;
+
+    if (stopping_.load())
+      return;
+
+    worker->sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (has_work(index) || stopping_.load()) {
+      worker->sleeping.store(false, std::memory_order_relaxed);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    while (worker->sleeping.load(std::memory_order_relaxed)) {
+      worker->cond.wait(lock);
+    }
+  }
+}
+
+Reactor* WorkerPool::reactor() {
+  return (current_ != nullptr) ? current_->reactor : nullptr;
+}
+
+namespace {
+
+// A response on its way from a worker to the Reactor loop
+struct Reply {
+  bool stream;
+  Socket handle;
+  unsigned long long serial;
+  struct sockaddr_in peer;
+  Reactor* reactor;
+  size_t len;
+  char data[1];
+};
+
+}
+
+bool WorkerPool::reply(const char* data, size_t len) {
+  if (current_ == nullptr)
+    return false;
+
+  Reply* response = (Reply*) malloc(offsetof(Reply, data) + len);
+  if (response == nullptr)
+    return false;
+  response->stream = current_->stream;
+  response->handle = current_->handle;
+  response->serial = current_->serial;
+  response->peer = current_->peer;
+  response->reactor = current_->reactor;
+  response->len = len;
+  memcpy(response->data, data, len);
+
+  // The Reactor never waits for the workers, so it frees room soon
+  while (!current_->reactor->post(send_reply, response)) {
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+/**
+ * @brief Run by the Reactor loop. The handle may have been closed, or
+ * even reused by another connection, since the message was received.
+ */
+void WorkerPool::send_reply(void* arg) {
+  Reply* response = (Reply*) arg;
+  if (response->stream) {
+    TcpHandler* stream = response->reactor->get_stream(response->handle);
+    if (stream != nullptr && stream->serial() == response->serial)
+      stream->send(response->data, response->len);
+  } else {
+    UdpHandler* dgram = response->reactor->get_dgram(response->handle);
+    if (dgram != nullptr && dgram->serial() == response->serial)
+      dgram->send(response->peer, response->data, response->len);
+  }
+  free(response);
+}
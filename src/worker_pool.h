@@ -0,0 +1,157 @@
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+
+class Reactor;
+
+/**
+ * @class WorkerPool
+ *
+ * @brief Threads running the read callbacks of the Reactors attached to
+ * it, so that a slow callback does not hold up the event loop. A message
+ * is copied into a lock-free single-producer single-consumer ring going
+ * from its Reactor to one worker, picked by a hash of the connection's
+ * handle or the datagram's peer. Messages of a connection or a peer thus
+ * reach the same worker, one at a time and in order.
+ *
+ * Callbacks answer with reply(), which posts the response back to the
+ * Reactor (see Reactor::post()). Event callbacks, e.g. a connection
+ * being closed, still run on the Reactor thread. Datagrams are always
+ * passed one by one to the read callback, the batch callback is not used.
+ */
+class WorkerPool {
+public:
+  /**
+   * @brief @a nthreads of 0 means one worker per online CPU.
+   */
+  WorkerPool(unsigned int nthreads=0);
+
+  /**
+   * @brief Stop the workers. Reactors must have been detached before.
+   */
+  ~WorkerPool();
+
+  /**
+   * @brief Have the read callbacks of @a reactor run by the workers, see
+   * Reactor::set_worker_pool(). Return the slot to pass to the methods
+   * below, -1 if WORKER_MAX_REACTORS Reactors are already attached.
+   */
+  int attach(Reactor* reactor);
+
+  /**
+   * @brief Give up @a slot, once idle() is true for it.
+   */
+  void detach(int slot);
+
+  /**
+   * @brief Copy a message for the workers, called by the thread of the
+   * Reactor attached as @a slot. @a serial tells the connection or socket
+   * apart from a later one with the same handle. When the ring to the
+   * worker is full, the message waits in a backlog for flush(). A message
+   * which cannot be copied is dropped and counted in ReactorStats::drops.
+   */
+  void dispatch_stream(int slot, Reactor* reactor, Socket h, unsigned long long serial,
+                       const char* data, size_t len);
+  void dispatch_dgram(int slot, Reactor* reactor, Socket h, unsigned long long serial,
+                      const struct sockaddr_in& peer, const char* data, size_t len);
+
+  /**
+   * @brief Move backlogged messages of @a slot into the rings which have
+   * room. Return true if some are still waiting.
+   */
+  bool flush(int slot);
+
+  /**
+   * @brief The workers are done with all messages of @a slot.
+   */
+  bool idle(int slot) const;
+
+  /**
+   * @brief From a callback run by a worker: send @a data to the connection
+   * or the peer the message came from, a datagram through the socket which
+   * received it. The data is copied and sent by the Reactor loop; it is
+   * dropped if the connection or socket is gone by then. Waits
+   * while the Reactor's task queue is full. Return false outside of a
+   * worker callback.
+   */
+  static bool reply(const char* data, size_t len);
+
+  /**
+   * @brief Reactor of the message being handled by the calling worker,
+   * nullptr outside of a worker callback.
+   */
+  static Reactor* reactor();
+
+  unsigned int size() const {
+    return nthreads_;
+  }
+
+private:
+  struct Item {
+    Reactor* reactor;
+    bool stream;
+    Socket handle;
+    unsigned long long serial;
+    struct sockaddr_in peer;
+    char* data;
+    size_t len;
+  };
+
+  // Ring from one Reactor to one worker. Only the Reactor thread moves
+  // the tail and only the worker moves the head, once an item is processed
+  struct Ring {
+    Item items[WORKER_QUEUE_SIZE];
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    char pad2[64];
+  };
+
+  // Rings of an attached Reactor, one per worker, and what did not fit
+  // in them. They are kept for the next Reactor using the slot.
+  struct Producer {
+    bool used;
+    std::vector<Ring*> rings;
+    std::vector<std::deque<Item> > backlogs;
+    size_t backlog;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> sleeping;
+  };
+
+  void push(int slot, size_t hash, const Item& item);
+  static bool put(Ring* ring, const Item& item);
+  void wake(Worker* worker);
+  void run(unsigned int index);
+  bool has_work(unsigned int index) const;
+  static void send_reply(void* arg);
+
+private:
+  unsigned int nthreads_;
+  std::vector<Worker*> workers_;
+  Producer producers_[WORKER_MAX_REACTORS];
+
+  // Slots of producers_ ever used, workers only look at these
+  std::atomic<unsigned int> nproducers_;
+  std::mutex attach_mutex_;
+
+  std::atomic<bool> stopping_;
+
+  // Message being handled by the calling worker
+  static thread_local const Item* current_;
+};
+
+#endif // WORKER_POOL_H_
@@ -0,0 +1,107 @@
+/**
+ *  Connection churn benchmark: connect to a ConnectionAcceptor over
+ *  loopback and close right away, in rounds of many connections, with at
+ *  most a few open at once. For each round it reports:
+ *    - slabs: slabs added to the Reactor's connection pools, 0 once the
+ *      pools hold as many objects as are ever open together
+ *    - new:   C++ heap allocations per connection left in the library,
+ *      i.e. the state a TcpHandler builds, not the objects themselves
+ *    - time per connection, accept and close included
+ *
+ *  Usage: churn_bench [connections per round] [rounds] [open at once]
+ */
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <sys/socket.h>
+#include <vector>
+
+#include "reactor.h"
+#include "connection_acceptor.h"
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Every C++ allocation of the process is counted, the benchmark itself
+// allocates nothing while a round runs
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+static Socket connect_to(const struct sockaddr_in& addr) {
+  Socket fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  return fd;
+}
+
+int main(int argc, char** argv) {
+  size_t count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 20000;
+  size_t rounds = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 5;
+  size_t open_max = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 100;
+
+  Reactor* reactor = Reactor::create(EPOLL_DEMUX);
+  ConnectionAcceptor* acceptor =
+    new ConnectionAcceptor(InetAddr(0, INADDR_LOOPBACK), reactor);
+
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(acceptor->get_handle(), (struct sockaddr*) &addr, &len);
+
+  ObjectPool* handlers = reactor->get_handler_pool();
+  ObjectPool* streams = reactor->get_stream_pool();
+  std::vector<Socket> clients;
+  clients.reserve(open_max);
+
+  printf("%zu connections per round, up to %zu open\n", count, open_max);
+  for (size_t r = 0; r < rounds; r++) {
+    size_t slabs = handlers->slab_count() + streams->slab_count();
+    size_t allocated = allocations;
+    unsigned long long start = now_ns();
+
+    for (size_t done = 0; done < count; done += open_max) {
+      size_t n = (count - done < open_max) ? count - done : open_max;
+      for (size_t i = 0; i < n; i++) {
+        clients.push_back(connect_to(addr));
+      }
+
+      TimeValue tv = {0, 10000};
+      while (handlers->in_use() < n)
+        reactor->handle_events(&tv);
+
+      for (size_t i = 0; i < n; i++) {
+        close(clients[i]);
+      }
+      clients.clear();
+      while (handlers->in_use() > 0)
+        reactor->handle_events(&tv);
+    }
+
+    unsigned long long elapsed = now_ns() - start;
+    printf("round %zu: %3zu slabs %6.2f new/conn %8.2f us/conn\n", r,
+           handlers->slab_count() + streams->slab_count() - slabs,
+           (double)(allocations - allocated) / count, (double) elapsed / 1000.0 / count);
+  }
+
+  delete acceptor;
+  delete reactor;
+  return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ *  Dispatch benchmark: cost per event of Reactor, which goes through the
+ *  virtual ReactorImpl and EventHandler, against BasicReactor with the
+ *  backend and handler types known at compile time. Every handle is a
+ *  pipe with one unread byte, so level-triggered demultiplexers report all
+ *  of them on every wait and the handlers only count events.
+ *
+ *  Usage: dispatch_bench [handles] [waits]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "reactor.h"
+#include "basic_reactor.h"
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t events = 0;
+
+class CountingHandler : public EventHandler {
+public:
+  CountingHandler(Socket h) : handle_(h) {
+  }
+
+  virtual void handle_event(Socket h, EventType et) {
+    events++;
+  }
+
+  virtual Socket get_handle() const {
+    return handle_;
+  }
+
+private:
+  Socket handle_;
+};
+
+// Same handler without virtual methods
+class StaticHandler {
+public:
+  StaticHandler(Socket h) : handle_(h) {
+  }
+
+  void handle_event(Socket h, EventType et) {
+    events++;
+  }
+
+  Socket get_handle() const {
+    return handle_;
+  }
+
+private:
+  Socket handle_;
+};
+
+template <class R>
+static void report(const char* name, R* reactor, size_t waits) {
+  TimeValue tv = {0, 0};
+  // Warm up caches and the kernel's ready list
+  for (size_t i = 0; i < 10; i++) {
+    reactor->handle_events(&tv);
+  }
+
+  events = 0;
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < waits; i++) {
+    reactor->handle_events(&tv);
+  }
+  unsigned long long elapsed = now_ns() - start;
+  printf("%-26s %8.1f ns/event (%zu events)\n", name, (double) elapsed / events, events);
+}
+
+int main(int argc, char** argv) {
+  size_t count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 1000;
+  size_t waits = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 2000;
+
+  std::vector<int> fds;
+  for (size_t i = 0; i < count; i++) {
+    int p[2];
+    if (pipe(p) < 0) {
+      perror("pipe");
+      return 1;
+    }
+    if (write(p[1], "x", 1) != 1)
+      return 1;
+    fds.push_back(p[0]);
+    fds.push_back(p[1]);
+  }
+
+  ReactorConfig config;
+  config.max_events = count;
+  printf("%zu ready handles, %zu waits\n", count, waits);
+
+  {
+    Reactor* reactor = Reactor::create(EPOLL_DEMUX, config);
+    std::vector<CountingHandler*> handlers;
+    for (size_t i = 0; i < count; i++) {
+      handlers.push_back(new CountingHandler(fds[2 * i]));
+      reactor->register_handler(handlers.back(), READ_EVENT);
+    }
+    report("Reactor epoll", reactor, waits);
+    for (size_t i = 0; i < count; i++) {
+      reactor->remove_handler(handlers[i], READ_EVENT);
+      delete handlers[i];
+    }
+    delete reactor;
+  }
+
+  {
+    BasicReactor<EpollBackend, EventHandler> reactor(config);
+    std::vector<CountingHandler*> handlers;
+    for (size_t i = 0; i < count; i++) {
+      handlers.push_back(new CountingHandler(fds[2 * i]));
+      reactor.register_handler(handlers.back(), READ_EVENT);
+    }
+    report("BasicReactor epoll virtual", &reactor, waits);
+    for (size_t i = 0; i < count; i++) {
+      reactor.remove_handler(handlers[i]);
+      delete handlers[i];
+    }
+  }
+
+  {
+    BasicReactor<EpollBackend, StaticHandler> reactor(config);
+    std::vector<StaticHandler> handlers;
+    handlers.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      handlers.push_back(StaticHandler(fds[2 * i]));
+      reactor.register_handler(&handlers.back(), READ_EVENT);
+    }
+    report("BasicReactor epoll static", &reactor, waits);
+  }
+
+  {
+    Reactor* reactor = Reactor::create(POLL_DEMUX, config);
+    std::vector<CountingHandler*> handlers;
+    for (size_t i = 0; i < count; i++) {
+      handlers.push_back(new CountingHandler(fds[2 * i]));
+      reactor->register_handler(handlers.back(), READ_EVENT);
+    }
+    report("Reactor poll", reactor, waits);
+    for (size_t i = 0; i < count; i++) {
+      reactor->remove_handler(handlers[i], READ_EVENT);
+      delete handlers[i];
+    }
+    delete reactor;
+  }
+
+  {
+    BasicReactor<PollBackend, StaticHandler> reactor(config);
+    std::vector<StaticHandler> handlers;
+    handlers.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      handlers.push_back(StaticHandler(fds[2 * i]));
+      reactor.register_handler(&handlers.back(), READ_EVENT);
+    }
+    report("BasicReactor poll static", &reactor, waits);
+  }
+
+  for (size_t i = 0; i < fds.size(); i++) {
+    close(fds[i]);
+  }
+  return 0;
+}
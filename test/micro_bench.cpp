@@ -0,0 +1,443 @@
+/**
+ *  Microbenchmarks of Reactor internals, on eventfds rather than network
+ *  traffic so that only the library's own costs are measured:
+ *    - register/remove: registering and removing one handler, with 10,
+ *      1000 and 100000 handles registered, for each readiness backend
+ *    - dispatch: one handle_events() spread over the ready handles, with
+ *      1 to 1000 of 1000 registered handles ready
+ *    - fd_sets: DemuxTable::convert_to_fd_sets() and the copy of the
+ *      three fd_sets select() needs on each wait
+ *    - timer: TimingWheel schedule, cancel and expire, per timer
+ *    - framing: SipFramer per message
+ *  All results are in nanoseconds per operation. io_uring is left out: it
+ *  reports an eventfd once per change, not for as long as it is readable.
+ *  With fewer descriptors allowed than asked, the largest runs use what
+ *  is available and are named after the count actually used.
+ *
+ *  Usage: micro_bench [--json file] [--compare baseline.json] [--threshold percent]
+ *  --compare prints the change against a file written by --json and exits
+ *  with 1 if a result is slower by more than the threshold (10% default).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "reactor.h"
+#include "reactor_impl.h"
+#include "sip_framer.h"
+#include "timer.h"
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Keep the compiler from optimizing away work whose result is unused
+static void clobber(void* p) {
+  asm volatile("" : : "r"(p) : "memory");
+}
+
+struct Result {
+  std::string name;
+  double ns;
+};
+
+static std::vector<Result> results;
+
+static void record(const std::string& name, double ns) {
+  Result result = { name, ns };
+  results.push_back(result);
+  printf("%-32s %12.1f ns\n", name.c_str(), ns);
+  fflush(stdout);
+}
+
+static size_t events = 0;
+
+class CountingHandler : public EventHandler {
+public:
+  CountingHandler() : handle_(INVALID_HANDLE_VALUE) {
+  }
+
+  void set_handle(Socket h) {
+    handle_ = h;
+  }
+
+  virtual void handle_event(Socket h, EventType et) {
+    events++;
+  }
+
+  virtual Socket get_handle() const {
+    return handle_;
+  }
+
+private:
+  Socket handle_;
+};
+
+struct Backend {
+  const char* name;
+  DemuxType type;
+};
+
+static const Backend backends[] = {
+  { "select", SELECT_DEMUX },
+  { "poll", POLL_DEMUX },
+#if defined (HAS_EPOLL)
+  { "epoll", EPOLL_DEMUX },
+#endif // HAS_EPOLL
+};
+
+/**
+ * @brief Eventfds made readable once and never read, so level-triggered
+ * demultiplexers report them on every wait.
+ */
+class Handles {
+public:
+  ~Handles() {
+    for (size_t i = 0; i < handlers_.size(); i++) {
+      close(handlers_[i].get_handle());
+    }
+  }
+
+  // Open up to @a count eventfds, return how many could be opened. A few
+  // descriptors are left for the Reactor itself
+  size_t open(size_t count) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        count + 64 > limit.rlim_cur)
+      count = (limit.rlim_cur > 64) ? limit.rlim_cur - 64 : 0;
+    handlers_.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (fd < 0)
+        break;
+      handlers_.push_back(CountingHandler());
+      handlers_.back().set_handle(fd);
+    }
+    return handlers_.size();
+  }
+
+  void make_ready(size_t count) {
+    unsigned long long one = 1;
+    for (size_t i = 0; i < count && i < handlers_.size(); i++) {
+      if (write(handlers_[i].get_handle(), &one, sizeof(one)) != sizeof(one))
+        perror("write");
+    }
+  }
+
+  CountingHandler& operator[](size_t i) {
+    return handlers_[i];
+  }
+
+  size_t size() const {
+    return handlers_.size();
+  }
+
+  // Highest descriptor, select() cannot go beyond FD_SETSIZE
+  Socket max_handle() const {
+    return handlers_.empty() ? 0 : handlers_.back().get_handle();
+  }
+
+private:
+  std::vector<CountingHandler> handlers_;
+};
+
+static void bench_registration(const Backend& backend, size_t wanted) {
+  Handles handles;
+  size_t count = handles.open(wanted);
+  if (backend.type == SELECT_DEMUX && handles.max_handle() >= (Socket) FD_SETSIZE)
+    return;
+
+  // Small counts are repeated so each measure lasts long enough
+  size_t rounds = (count < 100000) ? 100000 / count : 1;
+  unsigned long long registering = 0, removing = 0;
+  Reactor* reactor = Reactor::create(backend.type);
+  for (size_t r = 0; r < rounds; r++) {
+    unsigned long long start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+      reactor->register_handler(&handles[i], READ_EVENT);
+    }
+    unsigned long long middle = now_ns();
+    for (size_t i = 0; i < count; i++) {
+      reactor->remove_handler(&handles[i], READ_EVENT);
+    }
+    registering += middle - start;
+    removing += now_ns() - middle;
+  }
+  delete reactor;
+
+  char name[64];
+  snprintf(name, sizeof(name), "register/%s/%zu", backend.name, count);
+  record(name, (double) registering / (rounds * count));
+  snprintf(name, sizeof(name), "remove/%s/%zu", backend.name, count);
+  record(name, (double) removing / (rounds * count));
+}
+
+static void bench_dispatch(const Backend& backend, size_t registered, size_t ready) {
+  Handles handles;
+  if (handles.open(registered) < registered)
+    return;
+  handles.make_ready(ready);
+
+  Reactor* reactor = Reactor::create(backend.type);
+  for (size_t i = 0; i < registered; i++) {
+    reactor->register_handler(&handles[i], READ_EVENT);
+  }
+
+  TimeValue tv = {0, 0};
+  size_t waits = 200000 / ready + 100;
+  for (size_t i = 0; i < 10; i++) {
+    reactor->handle_events(&tv);
+  }
+  events = 0;
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < waits; i++) {
+    reactor->handle_events(&tv);
+  }
+  unsigned long long elapsed = now_ns() - start;
+
+  for (size_t i = 0; i < registered; i++) {
+    reactor->remove_handler(&handles[i], READ_EVENT);
+  }
+  delete reactor;
+
+  if (events != waits * ready) {
+    printf("dispatch/%s: %zu events instead of %zu\n", backend.name, events, waits * ready);
+    return;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "dispatch/%s/%zu-of-%zu", backend.name, ready, registered);
+  record(name, (double) elapsed / events);
+}
+
+static void bench_fd_sets() {
+  static CountingHandler handler;
+  DemuxTable* table = new DemuxTable();
+  for (int i = 0; i < 1000; i++) {
+    table->table_[i].event_handler = &handler;
+    table->table_[i].event_type = READ_EVENT;
+  }
+
+  const size_t iterations = 200000;
+  fd_set readset, writeset, exceptset;
+  Socket max_handle = 0;
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+    FD_ZERO(&exceptset);
+    table->convert_to_fd_sets(readset, writeset, exceptset, max_handle);
+    clobber(&readset);
+  }
+  record("fd_sets/convert/1000", (double)(now_ns() - start) / iterations);
+
+  // What SelectReactorImpl::handle_events() copies before each select()
+  fd_set rdset = readset, wrset = writeset, exset = exceptset;
+  start = now_ns();
+  for (size_t i = 0; i < iterations * 10; i++) {
+    clobber(&rdset);
+    readset = rdset;
+    writeset = wrset;
+    exceptset = exset;
+    clobber(&readset);
+    clobber(&writeset);
+    clobber(&exceptset);
+  }
+  record("fd_sets/copy", (double)(now_ns() - start) / (iterations * 10));
+  delete table;
+}
+
+static size_t fired = 0;
+
+static void on_timer(TimerId id, void* arg) {
+  fired++;
+}
+
+static void bench_timers() {
+  const size_t count = 1000000;
+  TimingWheel wheel(0);
+  std::vector<TimerId> ids(count);
+  std::vector<unsigned long long> delays(count);
+  srand(42);
+  for (size_t i = 0; i < count; i++) {
+    delays[i] = 1 + (rand() % 32000);
+  }
+
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < count; i++) {
+    ids[i] = wheel.schedule(delays[i], on_timer, nullptr);
+  }
+  record("timer/schedule", (double)(now_ns() - start) / count);
+
+  // Cancel every other timer, expire the rest
+  start = now_ns();
+  for (size_t i = 0; i < count; i += 2) {
+    wheel.cancel(ids[i]);
+  }
+  record("timer/cancel", (double)(now_ns() - start) / (count / 2));
+
+  fired = 0;
+  start = now_ns();
+  for (unsigned long long now = 1; wheel.size() != 0; now++) {
+    wheel.expire(now);
+  }
+  record("timer/expire", (double)(now_ns() - start) / fired);
+}
+
+static void bench_framing() {
+  static const char message[] =
+    "INVITE sip:bob@example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/TCP 192.0.2.1:5060;branch=z9hG4bK776asdhds\r\n"
+    "Max-Forwards: 70\r\n"
+    "To: Bob <sip:bob@example.com>\r\n"
+    "From: Alice <sip:alice@example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Contact: <sip:alice@pc33.example.com>\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 4\r\n\r\n"
+    "v=0\n";
+
+  // As many messages as a 16KB read brings
+  std::string chunk;
+  while (chunk.size() + sizeof(message) - 1 <= 16 * 1024) {
+    chunk.append(message, sizeof(message) - 1);
+  }
+
+  SipFramer framer;
+  const size_t rounds = 20000;
+  size_t messages = 0;
+  unsigned long long start = now_ns();
+  for (size_t r = 0; r < rounds; r++) {
+    size_t offset = 0;
+    while (offset < chunk.size()) {
+      offset += framer.append(chunk.data() + offset, chunk.size() - offset);
+      char* msg;
+      size_t len;
+      while (framer.next(&msg, &len) == SipFramer::MESSAGE) {
+        clobber(msg);
+        messages++;
+      }
+    }
+  }
+  record("framing/message", (double)(now_ns() - start) / messages);
+}
+
+/**
+ * @brief Read results written by write_json(), one per line.
+ */
+static bool read_json(const char* path, std::map<std::string, double>* baseline) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    perror(path);
+    return false;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char* name = strstr(line, "\"name\": \"");
+    char* value = strstr(line, "\"ns\": ");
+    if (name == nullptr || value == nullptr)
+      continue;
+    name += 9;
+    char* end = strchr(name, '"');
+    if (end == nullptr)
+      continue;
+    (*baseline)[std::string(name, end - name)] = strtod(value + 6, nullptr);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool write_json(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    perror(path);
+    return false;
+  }
+  fprintf(file, "{\n  \"unit\": \"ns/op\",\n  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    fprintf(file, "    {\"name\": \"%s\", \"ns\": %.2f}%s\n", results[i].name.c_str(),
+            results[i].ns, (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+// Return the number of results slower than the baseline by more than threshold
+static int compare(const std::map<std::string, double>& baseline, double threshold) {
+  int regressions = 0;
+  printf("\n%-32s %12s %12s %8s\n", "", "baseline", "now", "change");
+  for (size_t i = 0; i < results.size(); i++) {
+    std::map<std::string, double>::const_iterator it = baseline.find(results[i].name);
+    if (it == baseline.end() || it->second <= 0)
+      continue;
+    double change = (results[i].ns - it->second) * 100.0 / it->second;
+    bool slower = change > threshold;
+    if (slower)
+      regressions++;
+    printf("%-32s %12.1f %12.1f %+7.1f%%%s\n", results[i].name.c_str(), it->second,
+           results[i].ns, change, slower ? "  SLOWER" : "");
+  }
+  return regressions;
+}
+
+int main(int argc, char** argv) {
+  const char* json = nullptr;
+  const char* baseline_path = nullptr;
+  double threshold = 10.0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      threshold = strtod(argv[++i], nullptr);
+    } else {
+      fprintf(stderr, "Usage: %s [--json file] [--compare baseline.json] [--threshold percent]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (baseline_path != nullptr && !read_json(baseline_path, &baseline))
+    return 2;
+
+  // Reactors size their tables from the limit, raise it first
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  static const size_t counts[] = { 10, 1000, 100000 };
+  static const size_t ready[] = { 1, 10, 100, 1000 };
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+      bench_registration(backends[b], counts[i]);
+    }
+  }
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+    for (size_t i = 0; i < sizeof(ready) / sizeof(ready[0]); i++) {
+      bench_dispatch(backends[b], 1000, ready[i]);
+    }
+  }
+  bench_fd_sets();
+  bench_timers();
+  bench_framing();
+
+  if (json != nullptr && !write_json(json))
+    return 2;
+  if (baseline_path != nullptr && compare(baseline, threshold) > 0)
+    return 1;
+  return 0;
+}
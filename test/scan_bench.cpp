@@ -0,0 +1,116 @@
+/**
+ *  SIP scanning benchmark: find the end of headers and Content-Length of a
+ *  typical INVITE, with the old strstr/tolower approach and with each
+ *  implementation of the scanning kernels available on this CPU.
+ *
+ *  Usage: scan_bench [iterations]
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "sip_scan.h"
+
+static const char* invite_headers =
+  "INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+  "Via: SIP/2.0/TCP client.atlanta.example.com:5060;branch=z9hG4bK74bf9\r\n"
+  "Via: SIP/2.0/TCP proxy1.atlanta.example.com:5060;branch=z9hG4bK2d4790.1\r\n"
+  "Max-Forwards: 69\r\n"
+  "Record-Route: <sip:proxy1.atlanta.example.com;lr>\r\n"
+  "From: Alice <sip:alice@atlanta.example.com>;tag=9fxced76sl\r\n"
+  "To: Bob <sip:bob@biloxi.example.com>\r\n"
+  "Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+  "CSeq: 1 INVITE\r\n"
+  "Contact: <sip:alice@client.atlanta.example.com;transport=tcp>\r\n"
+  "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO\r\n"
+  "Supported: replaces, timer, 100rel\r\n"
+  "User-Agent: SIPp benchmark agent\r\n"
+  "Content-Type: application/sdp\r\n"
+  "Content-Length: 151\r\n"
+  "\r\n";
+
+static const char* invite_body =
+  "v=0\r\n"
+  "o=alice 2890844526 2890844526 IN IP4 client.atlanta.example.com\r\n"
+  "s=-\r\n"
+  "c=IN IP4 192.0.2.101\r\n"
+  "t=0 0\r\n"
+  "m=audio 49172 RTP/AVP 0\r\n"
+  "a=rtpmap:0 PCMU/8000\r\n";
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// What TcpHandler used to do: lower-case a copy of the headers, then
+// strstr() for the delimiters and atoi() the value
+static long legacy_scan(const char* msg, size_t len) {
+  const char* empty_line = strstr(msg, "\r\n\r\n");
+  if (empty_line == nullptr)
+    return -1;
+
+  size_t l = empty_line + 4 - msg;
+  char inter[l + 1];
+  strncpy(inter, msg, l);
+  inter[l] = '\0';
+  for (size_t j = 0; j < l; j++)
+    inter[j] = tolower(inter[j]);
+
+  const char* begin = strstr(inter, "content-length");
+  if (begin == nullptr && (begin = strstr(inter, "\r\nl")) == nullptr)
+    return -1;
+
+  const char* end = strstr(begin, "\r\n");
+  for (const char* p = begin; p < end; p++) {
+    if (isdigit(*p))
+      return atoi(p);
+  }
+  return -1;
+}
+
+static long kernel_scan(const char* msg, size_t len) {
+  const char* end = sip_find_header_end(msg, msg + len);
+  if (end == nullptr)
+    return -1;
+  return sip_content_length(msg, end + 2);
+}
+
+static volatile long sink;
+
+static void run(const char* name, long (*scan)(const char*, size_t),
+                const std::string& msg, size_t iterations) {
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    sink = scan(msg.c_str(), msg.size());
+  }
+  unsigned long long elapsed = now_ns() - start;
+
+  printf("%-8s %8.1f ns/msg %8.1f MB/s  Content-Length=%ld\n", name,
+         (double) elapsed / iterations,
+         (double) msg.size() * iterations * 1000.0 / elapsed, (long) sink);
+}
+
+int main(int argc, char** argv) {
+  size_t iterations = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 2000000;
+  std::string msg = std::string(invite_headers) + invite_body;
+
+  printf("message: %zu bytes, %zu iterations\n", msg.size(), iterations);
+  run("strstr", legacy_scan, msg, iterations);
+
+  static const char* impls[] = { "scalar", "sse2", "avx2" };
+  for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if (!sip_scan_select(impls[i])) {
+      printf("%-8s not supported\n", impls[i]);
+      continue;
+    }
+    run(impls[i], kernel_scan, msg, iterations);
+  }
+
+  // The legacy scan and every kernel must agree
+  return (kernel_scan(msg.c_str(), msg.size()) == legacy_scan(msg.c_str(), msg.size())) ? 0 : 1;
+}
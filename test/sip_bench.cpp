@@ -0,0 +1,473 @@
+/**
+ *  End-to-end SIP benchmark over loopback, for each demultiplexer
+ *  available. A Reactor thread answers every request with a 200 OK, an
+ *  open-loop generator sends requests at a fixed rate whether or not the
+ *  answers keep up, over UDP and over TCP connections. For each run it
+ *  reports:
+ *    - throughput: answers received per second
+ *    - latency percentiles, counted from the time each request was due to
+ *      be sent, so that a stalled server is not hidden by a generator
+ *      falling behind (coordinated omission)
+ *    - CPU time of the Reactor thread per answer
+ *    - lost: requests without an answer, e.g. dropped UDP datagrams
+ *  and for TCP the rate of connections set up, each one sending a request
+ *  and waiting for its answer before closing.
+ *
+ *  Usage: sip_bench [udp|tcp|all] [requests/s] [seconds] [connections]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined (HAS_IO_URING)
+#include <linux/io_uring.h>
+#endif // HAS_IO_URING
+
+#include "reactor.h"
+#include "connection_acceptor.h"
+#include "udp_handler.h"
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long deadline) {
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000000000ULL;
+  ts.tv_nsec = deadline % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+}
+
+struct Backend {
+  const char* name;
+  DemuxType type;
+  bool edge_triggered;
+};
+
+// Answer with the request's headers under a status line
+static size_t make_response(const char* request, size_t len, char* out, size_t size) {
+  static const char status[] = "SIP/2.0 200 OK";
+  const char* eol = (const char*) memmem(request, len, "\r\n", 2);
+  if (eol == nullptr)
+    return 0;
+  size_t rest = len - (eol - request);
+  if (sizeof(status) - 1 + rest > size)
+    return 0;
+  memcpy(out, status, sizeof(status) - 1);
+  memcpy(out + sizeof(status) - 1, eol, rest);
+  return sizeof(status) - 1 + rest;
+}
+
+static void on_stream(Socket h, char* message, size_t len) {
+  char out[1024];
+  size_t n = make_response(message, len, out, sizeof(out));
+  if (n > 0)
+    Reactor::current()->send_stream(h, out, n);
+}
+
+static void on_stream_event(Socket h, TcpState state) {
+}
+
+static void on_dgram(struct sockaddr_in peer, char* message, size_t len) {
+  char out[1024];
+  size_t n = make_response(message, len, out, sizeof(out));
+  if (n > 0)
+    Reactor::current()->send_dgram(peer, out, n);
+}
+
+static void on_dgram_event(UdpState state) {
+}
+
+/**
+ * @brief Reactor thread answering requests until stopped.
+ */
+class Server {
+public:
+  Server(const Backend& backend, bool tcp) {
+    ReactorConfig config;
+    config.edge_triggered = backend.edge_triggered;
+    reactor_ = Reactor::create(backend.type, config);
+    reactor_->register_tcp_callbacks(on_stream, on_stream_event);
+    reactor_->register_udp_callbacks(on_dgram, on_dgram_event);
+
+    acceptor_ = nullptr;
+    udp_ = nullptr;
+    Socket handle;
+    if (tcp) {
+      acceptor_ = new ConnectionAcceptor(InetAddr(0, INADDR_LOOPBACK), reactor_);
+      handle = acceptor_->get_handle();
+    } else {
+      udp_ = new UdpHandler(InetAddr(0, INADDR_LOOPBACK), reactor_);
+      handle = udp_->get_handle();
+      int size = 4 * 1024 * 1024;
+      setsockopt(handle, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    socklen_t len = sizeof(addr_);
+    getsockname(handle, (struct sockaddr*) &addr_, &len);
+
+    stop_.store(false);
+    cpu_ns_.store(0);
+    thread_ = std::thread(&Server::run, this);
+  }
+
+  ~Server() {
+    stop_.store(true);
+    thread_.join();
+    delete acceptor_;
+    delete udp_;
+    delete reactor_;
+  }
+
+  const struct sockaddr_in& address() const {
+    return addr_;
+  }
+
+  // CPU time of the Reactor thread so far
+  unsigned long long cpu_ns() const {
+    return cpu_ns_.load();
+  }
+
+private:
+  void run() {
+    unsigned long long start = thread_cpu_ns();
+    while (!stop_.load(std::memory_order_relaxed)) {
+      TimeValue tv = {0, 10000};
+      reactor_->handle_events(&tv);
+      cpu_ns_.store(thread_cpu_ns() - start, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  Reactor* reactor_;
+  ConnectionAcceptor* acceptor_;
+  UdpHandler* udp_;
+  struct sockaddr_in addr_;
+  std::thread thread_;
+  std::atomic<bool> stop_;
+  std::atomic<unsigned long long> cpu_ns_;
+};
+
+static size_t make_request(unsigned long long seq, char* out, size_t size) {
+  return snprintf(out, size,
+                  "MESSAGE sip:bench@127.0.0.1 SIP/2.0\r\n"
+                  "Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bK%llu\r\n"
+                  "From: <sip:load@127.0.0.1>;tag=1\r\n"
+                  "To: <sip:bench@127.0.0.1>\r\n"
+                  "Call-ID: %llu\r\n"
+                  "CSeq: 1 MESSAGE\r\n"
+                  "Content-Length: 0\r\n\r\n", seq, seq);
+}
+
+// Sequence number of a response, ~0 if it has none
+static unsigned long long response_seq(const char* data, size_t len) {
+  const char* id = (const char*) memmem(data, len, "Call-ID: ", 9);
+  if (id == nullptr)
+    return ~0ULL;
+  return strtoull(id + 9, nullptr, 10);
+}
+
+/**
+ * @brief Send times and latencies of one run. Request i is due at
+ * start + i * interval, its latency counts from then.
+ */
+struct Schedule {
+  Schedule(unsigned long rate, unsigned int seconds) {
+    count = (size_t) rate * seconds;
+    interval = 1000000000ULL / rate;
+    latency.assign(count, 0);
+    received.store(0);
+  }
+
+  unsigned long long due(size_t seq) const {
+    return start + seq * interval;
+  }
+
+  void answer(unsigned long long seq, unsigned long long now) {
+    if (seq >= count || latency[seq] != 0)
+      return;
+    latency[seq] = (now > due(seq)) ? now - due(seq) : 1;
+    received.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  size_t count;
+  unsigned long long interval;
+  unsigned long long start;
+  std::vector<unsigned long long> latency; // 0 until answered
+  std::atomic<size_t> received;
+};
+
+/**
+ * @brief Send every request once it is due, in bursts when the thread
+ * wakes up late. @a send is called with the sequence number.
+ */
+template <class Send>
+static void generate(Schedule& schedule, Send send) {
+  char request[512];
+  for (size_t seq = 0; seq < schedule.count; ) {
+    unsigned long long now = now_ns();
+    if (now < schedule.due(seq)) {
+      sleep_until(schedule.due(seq));
+      continue;
+    }
+    while (seq < schedule.count && schedule.due(seq) <= now) {
+      size_t len = make_request(seq, request, sizeof(request));
+      send(seq, request, len);
+      seq++;
+    }
+  }
+}
+
+static void report(const char* backend, const char* transport, Schedule& schedule,
+                   unsigned long long elapsed, unsigned long long cpu) {
+  std::vector<unsigned long long> sorted;
+  sorted.reserve(schedule.count);
+  for (size_t i = 0; i < schedule.count; i++) {
+    if (schedule.latency[i] != 0)
+      sorted.push_back(schedule.latency[i]);
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  size_t n = sorted.size();
+  if (n == 0) {
+    printf("%-12s %-4s no answer\n", backend, transport);
+    return;
+  }
+  double p50 = sorted[n / 2] / 1000.0;
+  double p99 = sorted[std::min(n - 1, n * 99 / 100)] / 1000.0;
+  double p999 = sorted[std::min(n - 1, n * 999 / 1000)] / 1000.0;
+  printf("%-12s %-4s %9.0f msg/s  p50 %8.1f  p99 %8.1f  p99.9 %8.1f us"
+         "  %6.2f us CPU/msg  lost %zu\n",
+         backend, transport, n * 1e9 / elapsed, p50, p99, p999,
+         cpu / 1000.0 / n, schedule.count - n);
+}
+
+static void run_udp(const Backend& backend, unsigned long rate, unsigned int seconds) {
+  Server server(backend, false);
+  Schedule schedule(rate, seconds);
+
+  Socket fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int size = 4 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  if (connect(fd, (const struct sockaddr*) &server.address(), sizeof(server.address())) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  struct timeval tv = {0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  unsigned long long cpu = server.cpu_ns();
+  schedule.start = now_ns() + 10000000ULL;
+  std::atomic<bool> sending(true);
+  std::thread receiver([&]() {
+    char buf[2048];
+    unsigned long long quiet_since = 0;
+    while (schedule.received.load() < schedule.count) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n > 0) {
+        schedule.answer(response_seq(buf, n), now_ns());
+        continue;
+      }
+      // Answers still missing a second after the last request are lost
+      if (!sending.load()) {
+        if (quiet_since == 0)
+          quiet_since = now_ns();
+        else if (now_ns() - quiet_since > 1000000000ULL)
+          break;
+      }
+    }
+  });
+
+  generate(schedule, [&](size_t seq, const char* data, size_t len) {
+    send(fd, data, len, 0);
+  });
+  sending.store(false);
+  receiver.join();
+  unsigned long long elapsed = now_ns() - schedule.start;
+  cpu = server.cpu_ns() - cpu;
+  close(fd);
+
+  report(backend.name, "udp", schedule, elapsed, cpu);
+}
+
+static Socket connect_to(const struct sockaddr_in& addr) {
+  Socket fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, (const struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  return fd;
+}
+
+static void run_tcp(const Backend& backend, unsigned long rate, unsigned int seconds,
+                    size_t nconns) {
+  Server server(backend, true);
+  Schedule schedule(rate, seconds);
+
+  std::vector<Socket> fds;
+  std::vector<struct pollfd> pfds;
+  for (size_t i = 0; i < nconns; i++) {
+    fds.push_back(connect_to(server.address()));
+    struct pollfd entry;
+    entry.fd = fds.back();
+    entry.events = POLLIN;
+    entry.revents = 0;
+    pfds.push_back(entry);
+  }
+
+  unsigned long long cpu = server.cpu_ns();
+  schedule.start = now_ns() + 10000000ULL;
+  std::atomic<bool> sending(true);
+  std::thread receiver([&]() {
+    std::vector<std::string> pending(nconns);
+    char buf[65536];
+    unsigned long long quiet_since = 0;
+    while (schedule.received.load() < schedule.count) {
+      int nready = poll(&pfds[0], pfds.size(), 100);
+      if (nready <= 0) {
+        if (!sending.load()) {
+          if (quiet_since == 0)
+            quiet_since = now_ns();
+          else if (now_ns() - quiet_since > 1000000000ULL)
+            break;
+        }
+        continue;
+      }
+      unsigned long long now = now_ns();
+      for (size_t i = 0; i < pfds.size(); i++) {
+        if (pfds[i].revents == 0)
+          continue;
+        ssize_t n = recv(pfds[i].fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+          pfds[i].fd = -1;
+          continue;
+        }
+        // Responses have no body, they end with an empty line
+        std::string& data = pending[i];
+        data.append(buf, n);
+        size_t begin = 0, end;
+        while ((end = data.find("\r\n\r\n", begin)) != std::string::npos) {
+          schedule.answer(response_seq(data.data() + begin, end - begin), now);
+          begin = end + 4;
+        }
+        data.erase(0, begin);
+      }
+    }
+  });
+
+  generate(schedule, [&](size_t seq, const char* data, size_t len) {
+    Socket fd = fds[seq % nconns];
+    while (len > 0) {
+      ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+      if (n <= 0)
+        return;
+      data += n;
+      len -= n;
+    }
+  });
+  sending.store(false);
+  receiver.join();
+  unsigned long long elapsed = now_ns() - schedule.start;
+  cpu = server.cpu_ns() - cpu;
+  for (size_t i = 0; i < fds.size(); i++) {
+    close(fds[i]);
+  }
+
+  report(backend.name, "tcp", schedule, elapsed, cpu);
+
+  // Connection setup: connect, one request and its answer, close
+  char request[512];
+  char buf[2048];
+  size_t len = make_request(0, request, sizeof(request));
+  size_t count = 0;
+  unsigned long long start = now_ns();
+  while (now_ns() - start < 1000000000ULL) {
+    Socket fd = connect_to(server.address());
+    send(fd, request, len, MSG_NOSIGNAL);
+    size_t got = 0;
+    while (got < 4 || memmem(buf, got, "\r\n\r\n", 4) == nullptr) {
+      ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+      if (n <= 0)
+        break;
+      got += n;
+    }
+    close(fd);
+    count++;
+  }
+  printf("%-12s %-4s %9.0f connections/s\n", backend.name, "tcp",
+         count * 1e9 / (now_ns() - start));
+}
+
+#if defined (HAS_IO_URING)
+// io_uring may be missing or forbidden, e.g. in containers
+static bool io_uring_available() {
+  struct io_uring_params params;
+  memset(&params, 0x00, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, 1, &params);
+  if (fd < 0)
+    return false;
+  close(fd);
+  return true;
+}
+#endif // HAS_IO_URING
+
+int main(int argc, char** argv) {
+  const char* transport = (argc > 1) ? argv[1] : "all";
+  unsigned long rate = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 20000;
+  unsigned int seconds = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 3;
+  size_t nconns = (argc > 4) ? strtoul(argv[4], nullptr, 10) : 16;
+  if (rate == 0 || seconds == 0 || nconns == 0) {
+    fprintf(stderr, "Usage: %s [udp|tcp|all] [requests/s] [seconds] [connections]\n", argv[0]);
+    return 1;
+  }
+  bool udp = strcmp(transport, "tcp") != 0;
+  bool tcp = strcmp(transport, "udp") != 0;
+
+  std::vector<Backend> backends;
+  Backend select_backend = { "select", SELECT_DEMUX, false };
+  Backend poll_backend = { "poll", POLL_DEMUX, false };
+  backends.push_back(select_backend);
+  backends.push_back(poll_backend);
+#if defined (HAS_EPOLL)
+  Backend epoll_backend = { "epoll", EPOLL_DEMUX, false };
+  Backend epoll_et_backend = { "epoll-et", EPOLL_DEMUX, true };
+  backends.push_back(epoll_backend);
+  backends.push_back(epoll_et_backend);
+#endif // HAS_EPOLL
+#if defined (HAS_IO_URING)
+  Backend io_uring_backend = { "io_uring", IO_URING_DEMUX, false };
+  if (io_uring_available())
+    backends.push_back(io_uring_backend);
+  else
+    printf("io_uring not available, skipped\n");
+#endif // HAS_IO_URING
+
+  printf("%lu requests/s for %u s, %zu TCP connections\n", rate, seconds, nconns);
+  for (size_t i = 0; i < backends.size(); i++) {
+    if (udp)
+      run_udp(backends[i], rate, seconds);
+    if (tcp)
+      run_tcp(backends[i], rate, seconds, nconns);
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ *  Timing wheel benchmark: schedule millions of timers with random delays,
+ *  cancel most of them as SIP transactions do, then expire the rest.
+ *  Then check that a loop sleeping until next_expiry() fires every timer
+ *  on time, including those crossing a turn of level 0.
+ *
+ *  Usage: timer_bench [timers] [cancel percent]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "timer.h"
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t fired = 0;
+static size_t early = 0;
+static size_t late = 0;
+static unsigned long long wheel_now = 0;
+
+static void on_timer(TimerId id, void* arg) {
+  unsigned long long expire = (unsigned long long)(size_t)arg;
+  if (expire > wheel_now)
+    early++;
+  if (expire < wheel_now)
+    late++;
+  fired++;
+}
+
+/**
+ * @brief Advance straight to next_expiry() each time, as a Reactor with
+ * nothing else to do sleeps. Return the number of timers fired late.
+ */
+static size_t check_next_expiry() {
+  TimingWheel wheel(0);
+  late = 0;
+  wheel_now = 0;
+  // Due just after a turn of level 0, scheduled from within the turn before
+  wheel.schedule(300, on_timer, (void*)(size_t)300);
+  wheel.schedule(257, on_timer, (void*)(size_t)257);
+  for (size_t i = 0; i < 100000; i++) {
+    unsigned long long delay = 1 + (rand() % 70000);
+    wheel.schedule(delay, on_timer, (void*)(size_t)delay);
+  }
+
+  while (wheel.size() != 0) {
+    wheel_now = wheel.next_expiry();
+    wheel.expire(wheel_now);
+  }
+  return late;
+}
+
+int main(int argc, char** argv) {
+  size_t count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 4000000;
+  unsigned int cancel_pct = (argc > 2) ? atoi(argv[2]) : 90;
+
+  TimingWheel wheel(0);
+  std::vector<TimerId> ids(count);
+  std::vector<unsigned long long> delays(count);
+
+  // SIP timer values range from T1 (500ms) to 64*T1 (32s)
+  srand(42);
+  for (size_t i = 0; i < count; i++) {
+    delays[i] = 1 + (rand() % 32000);
+  }
+
+  unsigned long long start = now_ns();
+  for (size_t i = 0; i < count; i++) {
+    ids[i] = wheel.schedule(delays[i], on_timer, (void*)(size_t)delays[i]);
+  }
+  unsigned long long scheduled = now_ns();
+
+  size_t cancelled = 0;
+  for (size_t i = 0; i < count; i++) {
+    if ((unsigned int)(rand() % 100) < cancel_pct) {
+      if (wheel.cancel(ids[i]))
+        cancelled++;
+    }
+  }
+  unsigned long long cancel_done = now_ns();
+
+  // Advance in 1ms steps as a busy reactor would
+  while (wheel.size() != 0) {
+    wheel_now++;
+    wheel.expire(wheel_now);
+  }
+  unsigned long long expired = now_ns();
+
+  // A handle must not cancel anything once its timer is gone
+  size_t stale = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (wheel.cancel(ids[i]))
+      stale++;
+  }
+
+  printf("timers:   %zu\n", count);
+  printf("schedule: %.1f ns/op\n", (double)(scheduled - start) / count);
+  printf("cancel:   %.1f ns/op (%zu cancelled)\n",
+         cancelled ? (double)(cancel_done - scheduled) / cancelled : 0.0, cancelled);
+  printf("expire:   %.1f ns/op (%zu fired over %llu ms)\n",
+         fired ? (double)(expired - cancel_done) / fired : 0.0, fired, wheel_now);
+
+  if (fired + cancelled != count || early != 0 || stale != 0) {
+    printf("FAILED: %zu lost, %zu fired early, %zu stale cancels\n",
+           count - fired - cancelled, early, stale);
+    return 1;
+  }
+
+  early = 0;
+  size_t missed = check_next_expiry();
+  if (missed != 0 || early != 0) {
+    printf("FAILED: sleeping until next_expiry() fired %zu late, %zu early\n", missed, early);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ *  reactor-top: live counters of the Reactors of a process created with
+ *  ReactorConfig::export_stats. The segment the process publishes to is
+ *  mapped read-only, so the process is neither stopped nor signaled.
+ *  Rates are per second over the interval between the copies read, an
+ *  age well above STATS_PUBLISH_MS means the loop is stuck in a handler.
+ *
+ *  Usage: reactor-top [-i interval_ms] [-n count] [-b] [pid]
+ *  Without a pid the processes which have a segment are listed. -n stops
+ *  after count screens, -b adds the histogram of events per wait.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "reactor_stats.h"
+
+static unsigned long long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool alive(int pid) {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+static int list_segments() {
+  const char* prefix = strrchr(STATS_SEGMENT_PREFIX, '/') + 1;
+  DIR* dir = opendir("/dev/shm");
+  if (dir == nullptr) {
+    perror("/dev/shm");
+    return 1;
+  }
+  int found = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0)
+      continue;
+    int pid = atoi(entry->d_name + strlen(prefix));
+    printf("%d%s\n", pid, alive(pid) ? "" : " (exited)");
+    found++;
+  }
+  closedir(dir);
+  if (found == 0)
+    printf("No process exports reactor counters\n");
+  return 0;
+}
+
+static const StatsSegment* map_segment(int pid) {
+  char path[64];
+  StatsExport::path(pid, path, sizeof(path));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(StatsSegment)) {
+    fprintf(stderr, "%s: not a reactor stats segment\n", path);
+    close(fd);
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror("mmap");
+    return nullptr;
+  }
+
+  const StatsSegment* segment = (const StatsSegment*) addr;
+  if (segment->magic != STATS_MAGIC || segment->version != STATS_VERSION) {
+    fprintf(stderr, "%s: unknown layout, version %u\n", path, segment->version);
+    munmap(addr, sizeof(StatsSegment));
+    return nullptr;
+  }
+  return segment;
+}
+
+static double rate(unsigned long long cur, unsigned long long prev, double seconds) {
+  return (cur >= prev && seconds > 0) ? (cur - prev) / seconds : 0.0;
+}
+
+static void print_screen(const StatsSegment* segment, StatsSlot* prev, bool* valid,
+                         unsigned int interval, bool histogram) {
+  if (isatty(STDOUT_FILENO))
+    printf("\033[H\033[2J");
+  printf("pid %d, interval %u ms\n", segment->pid, interval);
+  printf("%3s %7s %9s %9s %7s %9s %9s %9s %8s %8s %9s %9s %9s %9s %7s %7s %8s %6s\n",
+         "#", "tid", "loops/s", "wakeup/s", "ev/wake", "read/s", "write/s", "accept/s",
+         "ctl/s", "conn/s", "in MB/s", "out MB/s", "msg in/s", "msg out/s",
+         "drops", "trunc", "handlers", "age");
+
+  unsigned long long now = now_ms();
+  unsigned int count = (segment->nslots < STATS_MAX_REACTORS) ? segment->nslots : STATS_MAX_REACTORS;
+  for (unsigned int i = 0; i < count; i++) {
+    StatsSlot cur;
+    if (!StatsExport::read(&segment->slots[i], &cur)) {
+      valid[i] = false;
+      continue;
+    }
+    // A Reactor new to the slot shows its rates from the next screen on
+    if (!valid[i] || prev[i].tid != cur.tid || prev[i].stats.iterations > cur.stats.iterations) {
+      prev[i].tid = cur.tid;
+      prev[i].updated = cur.updated;
+      prev[i].stats = ReactorStats();
+    }
+
+    const ReactorStats& c = cur.stats;
+    const ReactorStats& p = prev[i].stats;
+    double seconds = (cur.updated - prev[i].updated) / 1000.0;
+    unsigned long long wakeups = c.wakeups - p.wakeups;
+    printf("%3u %7d %9.0f %9.0f %7.1f %9.0f %9.0f %9.0f %8.0f %8.0f %9.2f %9.2f %9.0f %9.0f %7llu %7llu %8lld %6llu\n",
+           i, cur.tid,
+           rate(c.iterations, p.iterations, seconds),
+           rate(c.wakeups, p.wakeups, seconds),
+           wakeups ? (double)(c.events - p.events) / wakeups : 0.0,
+           rate(c.sys_read, p.sys_read, seconds),
+           rate(c.sys_write, p.sys_write, seconds),
+           rate(c.sys_accept, p.sys_accept, seconds),
+           rate(c.sys_ctl, p.sys_ctl, seconds),
+           rate(c.accepts, p.accepts, seconds),
+           rate(c.bytes_in, p.bytes_in, seconds) / 1e6,
+           rate(c.bytes_out, p.bytes_out, seconds) / 1e6,
+           rate(c.messages_in, p.messages_in, seconds),
+           rate(c.messages_out, p.messages_out, seconds),
+           c.drops - p.drops, c.truncations - p.truncations, c.handlers,
+           (now > cur.updated) ? now - cur.updated : 0);
+
+    if (histogram) {
+      unsigned long long waits = c.sys_wait - p.sys_wait;
+      printf("    events per wait:");
+      for (unsigned int b = 0; b < STATS_BATCH_BUCKETS; b++) {
+        unsigned long long n = c.batch[b] - p.batch[b];
+        if (b == 0)
+          printf(" 0:");
+        else if (b == 1)
+          printf(" 1:");
+        else if (b == STATS_BATCH_BUCKETS - 1)
+          printf(" %u+:", 1U << (b - 1));
+        else
+          printf(" %u-%u:", 1U << (b - 1), (1U << b) - 1);
+        printf("%.0f%%", waits ? 100.0 * n / waits : 0.0);
+      }
+      printf("\n");
+    }
+
+    prev[i].tid = cur.tid;
+    prev[i].updated = cur.updated;
+    prev[i].stats = cur.stats;
+    valid[i] = true;
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  unsigned int interval = 1000;
+  unsigned long screens = 0;
+  bool histogram = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:b")) != -1) {
+    switch (opt) {
+    case 'i':
+      interval = strtoul(optarg, nullptr, 10);
+      break;
+    case 'n':
+      screens = strtoul(optarg, nullptr, 10);
+      break;
+    case 'b':
+      histogram = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-i interval_ms] [-n count] [-b] [pid]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc)
+    return list_segments();
+
+  int pid = atoi(argv[optind]);
+  const StatsSegment* segment = map_segment(pid);
+  if (segment == nullptr)
+    return 1;
+  if (interval < STATS_PUBLISH_MS)
+    interval = STATS_PUBLISH_MS;
+
+  static StatsSlot prev[STATS_MAX_REACTORS];
+  bool valid[STATS_MAX_REACTORS];
+  for (unsigned int i = 0; i < STATS_MAX_REACTORS; i++) {
+    valid[i] = StatsExport::read(&segment->slots[i], &prev[i]);
+  }
+
+  for (unsigned long n = 0; screens == 0 || n < screens; n++) {
+    usleep(interval * 1000);
+    if (!alive(pid)) {
+      printf("Process %d exited\n", pid);
+      return 1;
+    }
+    print_screen(segment, prev, valid, interval, histogram);
+  }
+  return 0;
+}